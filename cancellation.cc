@@ -0,0 +1,7 @@
+#include "cancellation.h"
+
+namespace harb {
+
+std::atomic<bool> Cancellation::requested_(false);
+
+}
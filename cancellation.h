@@ -0,0 +1,26 @@
+#ifndef HARB_CANCELLATION_H
+#define HARB_CANCELLATION_H
+
+#include <atomic>
+
+namespace harb {
+
+// Cooperative cancellation of the running command. A SIGINT or a timeout
+// requests cancellation, and long loops poll requested() and bail out, so
+// the command returns to the prompt with the graph intact. requested() is
+// a relaxed load, cheap enough to poll every iteration.
+class Cancellation {
+  static std::atomic<bool> requested_;
+
+public:
+  static bool requested() { return requested_.load(std::memory_order_relaxed); }
+
+  // Safe to call from a signal handler
+  static void request() { requested_.store(true, std::memory_order_relaxed); }
+
+  static void reset() { requested_.store(false, std::memory_order_relaxed); }
+};
+
+}
+
+#endif // HARB_CANCELLATION_H
@@ -0,0 +1,174 @@
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+
+#include "checkpoint.h"
+#include "input_stream.h"
+
+namespace harb {
+
+static const uint64_t kMagic = 0x54504b4342524148ULL; // "HARBCKPT"
+static const uint64_t kEndMagic = ~kMagic;
+static const uint32_t kVersion = 3;
+
+// After the payload: its CRC-32, then kEndMagic
+static const size_t kTrailerSize = sizeof(uint32_t) + sizeof(uint64_t);
+
+Checkpoint::File::File(FILE *file, Phase phase, bool writing, uint64_t remaining)
+  : file(file), phase(phase), writing(writing), ok(true), remaining(remaining), crc(crc32(0, NULL, 0)) {}
+
+void Checkpoint::File::checksum(const void *data, size_t length) {
+  // crc32() takes a 32-bit length
+  const Bytef *p = (const Bytef *) data;
+  while (length > 0) {
+    uInt chunk = (uInt) std::min<size_t>(length, 1U << 30);
+    crc = crc32(crc, p, chunk);
+    p += chunk;
+    length -= chunk;
+  }
+}
+
+Checkpoint::Checkpoint(const char *dir, bool resume) : dir_(dir), resume_(resume), enabled_(false) {
+  memset(&header_, 0, sizeof(header_));
+  for (int i = 0; i < kNumPhases; ++i) {
+    restored_[i] = false;
+  }
+}
+
+bool Checkpoint::set_source(InputStream *in, double sample_rate, size_t value_bytes) {
+  struct stat st;
+  if (stat(in->get_path(), &st) != 0 || !S_ISREG(st.st_mode)) {
+    error_ = std::string(in->get_path()) + " is not a regular file, so it can't be checkpointed";
+    enabled_ = false;
+    return false;
+  }
+
+  // Zeroed first, so padding doesn't get in the way of comparing headers
+  memset(&header_, 0, sizeof(header_));
+  header_.magic = kMagic;
+  header_.version = kVersion;
+  header_.dev = st.st_dev;
+  header_.ino = st.st_ino;
+  header_.size = st.st_size;
+  header_.mtime_sec = st.st_mtim.tv_sec;
+  header_.mtime_nsec = st.st_mtim.tv_nsec;
+  header_.sample_rate = sample_rate;
+  header_.value_bytes = value_bytes;
+  enabled_ = true;
+  return true;
+}
+
+std::string Checkpoint::get_path(Phase phase) {
+  return dir_ + "/" + get_phase_name(phase) + ".ckpt";
+}
+
+void Checkpoint::set_error(const std::string &path, const char *what) {
+  if (error_.empty()) {
+    error_ = what + (" " + path) + ": " + strerror(errno);
+  }
+}
+
+Checkpoint::File * Checkpoint::open(Phase phase) {
+  if (!enabled_ || !resume_) {
+    return NULL;
+  }
+
+  std::string path = get_path(phase);
+  FILE *file = fopen(path.c_str(), "rb");
+  if (!file) {
+    return NULL;
+  }
+
+  Header expected = header_, header;
+  expected.phase = phase;
+  struct stat st;
+  if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(&header, &expected, sizeof(header)) != 0 ||
+      fstat(fileno(file), &st) != 0 || (uint64_t) st.st_size < sizeof(header) + kTrailerSize) {
+    // Written for another dump (or with other options, or by another
+    // version), so the phase is redone and the file replaced
+    fclose(file);
+    return NULL;
+  }
+  File *f = new File(file, phase, false, st.st_size - sizeof(header) - kTrailerSize);
+  f->checksum(&header, sizeof(header));
+  return f;
+}
+
+Checkpoint::File * Checkpoint::create(Phase phase) {
+  if (!enabled_) {
+    return NULL;
+  }
+
+  if (mkdir(dir_.c_str(), 0755) != 0 && errno != EEXIST) {
+    set_error(dir_, "unable to create");
+    return NULL;
+  }
+
+  std::string path = get_path(phase) + ".tmp";
+  FILE *file = fopen(path.c_str(), "wb");
+  if (!file) {
+    set_error(path, "unable to create");
+    return NULL;
+  }
+
+  File *f = new File(file, phase, true);
+  Header header = header_;
+  header.phase = phase;
+  f->write(header);
+  return f;
+}
+
+bool Checkpoint::close(File *file) {
+  std::string path = get_path(file->phase);
+  bool ok;
+
+  if (file->writing) {
+    std::string tmp = path + ".tmp";
+    uint32_t crc = file->crc;
+    file->write(crc);
+    file->write(kEndMagic);
+    ok = file->ok && fflush(file->file) == 0 && fsync(fileno(file->file)) == 0;
+    ok = fclose(file->file) == 0 && ok;
+    if (ok && rename(tmp.c_str(), path.c_str()) == 0) {
+      delete file;
+      return true;
+    }
+    set_error(tmp, "unable to write");
+    unlink(tmp.c_str());
+  } else {
+    // Anything left before the trailer means the file doesn't match what
+    // was read
+    uint32_t crc = file->crc;
+    ok = file->remaining == 0;
+    file->remaining = kTrailerSize;
+    ok = file->read<uint32_t>() == crc && file->read<uint64_t>() == kEndMagic && file->ok && ok;
+    fclose(file->file);
+    if (ok) {
+      restored_[file->phase] = true;
+    } else if (error_.empty()) {
+      error_ = path + " is damaged, so it was not used";
+    }
+  }
+
+  delete file;
+  return ok;
+}
+
+const char * Checkpoint::get_phase_name(Phase phase) {
+  switch (phase) {
+    case kParsed:
+      return "parsed";
+    case kReferences:
+      return "references";
+    case kDominators:
+      return "dominators";
+    default:
+      return "unknown";
+  }
+}
+
+}
@@ -0,0 +1,139 @@
+#ifndef HARB_CHECKPOINT_H
+#define HARB_CHECKPOINT_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <string>
+
+namespace harb {
+
+class InputStream;
+
+// Checkpoints of a graph load, so a long load that is killed part way can
+// be resumed. Each phase (parsing, resolving references, the dominator
+// tree) is saved to a file of its own in a work directory. A file is
+// written under a temporary name and only renamed into place once it is
+// complete, and its header records the identity of the dump (device, inode,
+// size and mtime) and the options that change what's loaded, so a resumed
+// load only uses checkpoints written for the same dump.
+class Checkpoint {
+  public:
+    enum Phase { kParsed = 0, kReferences, kDominators, kNumPhases };
+
+    // A phase's checkpoint being written or read. Values are copied in
+    // native byte order, since checkpoints are only meant to be read back
+    // on the same machine, and a CRC-32 of everything is checked when the
+    // file is closed. Errors are sticky: once a read or write fails the
+    // rest are skipped and is_ok() returns false.
+    class File {
+      public:
+        template<typename T> void write(const T *values, size_t n) {
+          if (ok && n && fwrite(values, sizeof(T), n, file) != n) {
+            ok = false;
+          }
+          checksum(values, sizeof(T) * n);
+        }
+
+        template<typename T> void write(const T &value) { write(&value, 1); }
+
+        template<typename T> void read(T *values, size_t n) {
+          if (ok && n && (!can_read(n, sizeof(T)) || fread(values, sizeof(T), n, file) != n)) {
+            ok = false;
+          }
+          if (ok) {
+            remaining -= sizeof(T) * n;
+            checksum(values, sizeof(T) * n);
+          }
+        }
+
+        template<typename T> T read() {
+          T value = T();
+          read(&value, 1);
+          return value;
+        }
+
+        bool is_ok() { return ok; }
+
+        // Marks the file as bad, e.g. when a value read back is out of range
+        void fail() { ok = false; }
+
+        // Whether n values of size bytes are left to read. Lengths read back
+        // are checked with this before anything is allocated for them, so
+        // a damaged one fails the file instead of exhausting memory.
+        bool can_read(uint64_t n, size_t size) {
+          if (size && n > remaining / size) {
+            ok = false;
+          }
+          return ok;
+        }
+
+      private:
+        friend class Checkpoint;
+
+        FILE *file;
+        Phase phase;
+        bool writing;
+        bool ok;
+        uint64_t remaining; // bytes before the trailer, when reading
+        uint32_t crc;
+
+        File(FILE *file, Phase phase, bool writing, uint64_t remaining = 0);
+
+        void checksum(const void *data, size_t length);
+    };
+
+    // Checkpoints are written to dir. With resume, phases that have a
+    // checkpoint for the same dump are read back instead of recomputed.
+    Checkpoint(const char *dir, bool resume);
+
+    // Ties the checkpoints to the dump being loaded. Returns false (and
+    // nothing is checkpointed) if in isn't a regular file.
+    bool set_source(InputStream *in, double sample_rate, size_t value_bytes);
+
+    // When resuming, opens phase's checkpoint if it was written for the
+    // same dump. Returns NULL otherwise.
+    File * open(Phase phase);
+
+    // Starts writing phase's checkpoint. Returns NULL if it can't be
+    // created.
+    File * create(Phase phase);
+
+    // Closes and deletes file. A file from create() is renamed into place
+    // if everything was written, and removed otherwise. Returns false if
+    // anything failed; for a file from open() this includes a checksum that
+    // doesn't match and a missing end marker.
+    bool close(File *file);
+
+    bool is_restored(Phase phase) { return restored_[phase]; }
+
+    // The first error writing or reading a checkpoint, or NULL
+    const char * get_error() { return error_.empty() ? NULL : error_.c_str(); }
+
+    static const char * get_phase_name(Phase phase);
+
+  private:
+    struct Header {
+      uint64_t magic;
+      uint32_t version;
+      uint32_t phase;
+      uint64_t dev, ino, size;
+      int64_t mtime_sec, mtime_nsec;
+      double sample_rate;
+      uint64_t value_bytes;
+    };
+
+    std::string dir_;
+    bool resume_;
+    bool enabled_;
+    Header header_;
+    bool restored_[kNumPhases];
+    std::string error_;
+
+    std::string get_path(Phase phase);
+    void set_error(const std::string &path, const char *what);
+};
+
+}
+
+#endif // HARB_CHECKPOINT_H
@@ -0,0 +1,112 @@
+#include <string.h>
+
+#include <algorithm>
+
+#include "completion.h"
+#include "graph.h"
+
+namespace harb {
+
+static size_t common_prefix_length(const std::string &a, const std::string &b) {
+  size_t n = 0;
+  while (n < a.size() && n < b.size() && a[n] == b[n]) {
+    n++;
+  }
+  return n;
+}
+
+static std::string format_address(uint64_t addr) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "0x%" PRIx64, addr);
+  return buf;
+}
+
+bool Completer::complete_address(const char *text, std::vector<std::string> &matches) {
+  if (strncmp(text, "0x", 2) != 0) {
+    return false;
+  }
+  const char *digits = text + 2;
+  size_t len = strlen(digits);
+  if (len > 16 || strspn(digits, "0123456789abcdef") != len) {
+    return false;
+  }
+  uint64_t prefix = len ? strtoull(digits, NULL, 16) : 0;
+  partial_ = false;
+
+  // The addresses printed with n hex digits that start with the prefix form
+  // one numeric range per n, so each is found with two binary searches
+  const std::vector<uint64_t> &addrs = graph_->get_sorted_addresses();
+  std::vector<std::pair<size_t, size_t>> ranges;
+  size_t count = 0;
+  for (size_t n = std::max<size_t>(len, 1); n <= 16; ++n) {
+    int shift = 4 * (n - len);
+    uint64_t lo = shift >= 64 ? 0 : prefix << shift;
+    uint64_t hi = shift >= 64 ? UINT64_MAX : lo | ((1ULL << shift) - 1);
+    if (n > 1) {
+      lo = std::max<uint64_t>(lo, 1ULL << (4 * (n - 1)));
+    }
+    if (lo > hi) {
+      continue;
+    }
+    auto begin = std::lower_bound(addrs.begin(), addrs.end(), lo);
+    auto end = std::upper_bound(begin, addrs.end(), hi);
+    if (begin != end) {
+      ranges.push_back(std::make_pair(begin - addrs.begin(), end - addrs.begin()));
+      count += end - begin;
+    }
+  }
+
+  if (count <= kMaxMatches) {
+    for (auto &r : ranges) {
+      for (size_t i = r.first; i < r.second; ++i) {
+        matches.push_back(format_address(addrs[i]));
+      }
+    }
+  } else {
+    partial_ = true;
+    // Within a range numeric order is string order, so the first and last
+    // address of each range bound the common prefix
+    std::string common = format_address(addrs[ranges[0].first]);
+    size_t common_len = common.size();
+    for (auto &r : ranges) {
+      common_len = std::min(common_len, common_prefix_length(common, format_address(addrs[r.first])));
+      common_len = std::min(common_len, common_prefix_length(common, format_address(addrs[r.second - 1])));
+    }
+    matches.push_back(common.substr(0, common_len));
+  }
+  return true;
+}
+
+void Completer::build_class_names() {
+  graph_->each_heap_object([&] (RubyHeapObj *obj) {
+    uint32_t type = obj->get_type();
+    if ((type == RUBY_T_CLASS || type == RUBY_T_MODULE) && obj->get_value()) {
+      class_names_.push_back(obj->get_value());
+    }
+  });
+  std::sort(class_names_.begin(), class_names_.end());
+  class_names_.erase(std::unique(class_names_.begin(), class_names_.end()), class_names_.end());
+  class_names_built_ = true;
+}
+
+void Completer::complete_class_name(const char *text, std::vector<std::string> &matches) {
+  if (!class_names_built_) {
+    build_class_names();
+  }
+
+  std::string prefix(text);
+  partial_ = false;
+  auto begin = std::lower_bound(class_names_.begin(), class_names_.end(), prefix);
+  auto end = std::partition_point(begin, class_names_.end(), [&] (const std::string &name) {
+    return name.compare(0, prefix.size(), prefix) == 0;
+  });
+
+  if ((size_t) (end - begin) <= kMaxMatches) {
+    matches.insert(matches.end(), begin, end);
+  } else {
+    partial_ = true;
+    matches.push_back(begin->substr(0, common_prefix_length(*begin, *(end - 1))));
+  }
+}
+
+}
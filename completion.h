@@ -0,0 +1,45 @@
+#ifndef HARB_COMPLETION_H
+#define HARB_COMPLETION_H
+
+#include <inttypes.h>
+
+#include <string>
+#include <vector>
+
+namespace harb {
+
+class Graph;
+
+// Prefix indexes over a graph's object addresses and class names for
+// completing command arguments. Both are sorted columns built on first
+// use, so a completion is a handful of binary searches.
+class Completer {
+  Graph *graph_;
+  std::vector<std::string> class_names_;
+  bool class_names_built_;
+  bool partial_;
+
+  void build_class_names();
+
+public:
+  // Beyond this many matches only their common prefix is returned
+  static const size_t kMaxMatches = 256;
+
+  Completer(Graph *graph) : graph_(graph), class_names_built_(false), partial_(false) {}
+
+  // Adds the addresses (as "0x..." strings) starting with text to matches.
+  // If there are more than kMaxMatches, only their longest common prefix
+  // is added. Returns false if text isn't a hex address prefix.
+  bool complete_address(const char *text, std::vector<std::string> &matches);
+
+  // Adds the names of classes and modules starting with text to matches,
+  // or their longest common prefix if there are more than kMaxMatches
+  void complete_class_name(const char *text, std::vector<std::string> &matches);
+
+  // True if the last completion only returned a common prefix
+  bool is_partial() { return partial_; }
+};
+
+}
+
+#endif // HARB_COMPLETION_H
@@ -1,4 +1,7 @@
+#include <algorithm>
+
 #include "dominator_tree.h"
+#include "parallel.h"
 
 #define likely(x)      __builtin_expect(!!(x), 1)
 #define unlikely(x)    __builtin_expect(!!(x), 0)
@@ -10,34 +13,40 @@ DominatorTree::DominatorTree(RubyHeapObj *root, int32_t num_nodes)
   progress = new harb::Progress("generating dominator tree", num_nodes * 3);
   progress->start();
 
-  arr = new int32_t[num_nodes];
-  rev = new int32_t[num_nodes];
-  label = new int32_t[num_nodes];
-  sdom = new int32_t[num_nodes];
-  dom = new int32_t[num_nodes];
-  parent = new int32_t[num_nodes];
-  dsu = new int32_t[num_nodes];
-  objs = new RubyHeapObj*[num_nodes];
+  arr = new int32_t[this->num_nodes]();
+  rev = new int32_t[this->num_nodes];
+  label = new int32_t[this->num_nodes];
+  sdom = new int32_t[this->num_nodes];
+  dom = new int32_t[this->num_nodes];
+  parent = new int32_t[this->num_nodes];
+  dsu = new int32_t[this->num_nodes];
+  objs = new RubyHeapObj*[this->num_nodes]();
+  retained = new size_t[this->num_nodes]();
+
+  idoms = new int32_t[this->num_nodes]();
+  child_start = new int32_t[this->num_nodes + 1]();
+  children = NULL;
 
-  reverse_graph = new std::vector<int32_t>*[num_nodes];
-  bucket = new std::vector<int32_t>*[num_nodes];
-  tree = new std::vector<int32_t>*[num_nodes];
+  reverse_graph = new std::vector<int32_t>*[this->num_nodes];
+  bucket = new std::vector<int32_t>*[this->num_nodes];
 
   for (int32_t i = 0; i < this->num_nodes; ++i) {
     reverse_graph[i] = new std::vector<int32_t>();
     bucket[i] = new std::vector<int32_t>();
-    tree[i] = new std::vector<int32_t>();
   }
 }
 
+DominatorTree::DominatorTree(RubyHeapObj *root)
+  : root(root), num_nodes(0), count(0), objs(NULL), retained(NULL), idoms(NULL), child_start(NULL),
+    children(NULL), progress(NULL) {
+}
+
 DominatorTree::~DominatorTree() {
   delete[] objs;
-
-  for (int32_t i = 0; i < this->num_nodes; ++i) {
-    delete tree[i];
-  }
-
-  delete[] tree;
+  delete[] retained;
+  delete[] idoms;
+  delete[] child_start;
+  delete[] children;
 
   delete progress;
 }
@@ -127,11 +136,24 @@ void DominatorTree::calculate_sdom() {
   }
 }
 
+void DominatorTree::calculate_retained_sizes() {
+  // Dominators always have a lower DFS number than the nodes they dominate,
+  // so walking the numbering backwards visits children before parents.
+  for (int32_t i = count; i >= 1; i--) {
+    RubyHeapObj *obj = objs[rev[i]];
+    retained[rev[i]] += obj->is_root_object() ? 0 : obj->get_memsize();
+    if (i > 1) {
+      retained[rev[dom[i]]] += retained[rev[i]];
+    }
+  }
+}
+
 void DominatorTree::cleanup_intermediate_state() {
   delete[] arr;
   delete[] rev;
   delete[] label;
   delete[] sdom;
+  delete[] dom;
   delete[] parent;
   delete[] dsu;
 
@@ -143,6 +165,33 @@ void DominatorTree::cleanup_intermediate_state() {
   delete[] bucket;
 }
 
+void DominatorTree::build_children() {
+  // Counting sort of the nodes by idom, so each node's children are one
+  // contiguous run
+  for (int32_t i = 2; i <= count; i++) {
+    idoms[rev[i]] = rev[dom[i]];
+    child_start[rev[dom[i]] + 1]++;
+  }
+  for (int32_t i = 0; i < num_nodes; i++) {
+    child_start[i + 1] += child_start[i];
+  }
+
+  children = new int32_t[std::max(count - 1, 1)];
+  std::vector<int32_t> next(child_start, child_start + num_nodes);
+  for (int32_t i = 2; i <= count; i++) {
+    children[next[rev[dom[i]]]++] = rev[i];
+  }
+
+  // Largest first, so browsing the tree never has to sort
+  parallel_for(num_nodes, [&] (size_t begin, size_t end, size_t) {
+    for (size_t i = begin; i < end; ++i) {
+      std::sort(children + child_start[i], children + child_start[i + 1], [&] (int32_t a, int32_t b) {
+        return retained[a] > retained[b] || (retained[a] == retained[b] && a < b);
+      });
+    }
+  });
+}
+
 void DominatorTree::calculate() {
   progress->start();
 
@@ -159,30 +208,70 @@ void DominatorTree::calculate() {
       dom[i] = dom[dom[i]];
     }
 
-    tree[rev[i]]->push_back(rev[dom[i]]);
-    tree[rev[dom[i]]]->push_back(rev[i]);
     progress->increment();
   }
 
+  calculate_retained_sizes();
+  build_children();
+
   cleanup_intermediate_state();
 
+  progress->set_items(count);
   progress->complete();
 }
 
-void DominatorTree::retained_size(RubyHeapObj *obj, size_t &size) {
-  size += obj->is_root_object() ? 0 : obj->get_memsize();
-
-  if (obj != root) {
-    auto t = tree[obj->get_index()];
-    if (t->size() == 1) {
-      return;
-    } else {
-      for (size_t i = 1; i < t->size(); i++) {
-        RubyHeapObj *obj = objs[(*t)[i]];
-        retained_size(obj, size);
-      }
+void DominatorTree::save(Checkpoint::File *out) {
+  out->write(num_nodes);
+  out->write(count);
+  out->write(idoms, num_nodes);
+  out->write(retained, num_nodes);
+  out->write(child_start, num_nodes + 1);
+  out->write(children, std::max(count - 1, 1));
+}
+
+DominatorTree * DominatorTree::restore(Checkpoint::File *in, RubyHeapObj *root, const RubyHeapObjList &nodes) {
+  int32_t num_nodes = in->read<int32_t>();
+  int32_t count = in->read<int32_t>();
+  if (!in->is_ok() || num_nodes != (int32_t) nodes.size() || count < 1 || count > num_nodes) {
+    in->fail();
+    return NULL;
+  }
+
+  DominatorTree *tree = new DominatorTree(root);
+  tree->num_nodes = num_nodes;
+  tree->count = count;
+  tree->idoms = new int32_t[num_nodes];
+  tree->retained = new size_t[num_nodes];
+  tree->child_start = new int32_t[num_nodes + 1];
+  tree->children = new int32_t[std::max(count - 1, 1)];
+  in->read(tree->idoms, num_nodes);
+  in->read(tree->retained, num_nodes);
+  in->read(tree->child_start, num_nodes + 1);
+  in->read(tree->children, std::max(count - 1, 1));
+
+  // Check every index before it's used, so a damaged checkpoint can't
+  // point outside the graph
+  bool ok = in->is_ok() && tree->child_start[0] == 0 && tree->child_start[num_nodes] == count - 1;
+  for (int32_t i = 0; ok && i < num_nodes; ++i) {
+    ok = tree->idoms[i] >= 0 && tree->idoms[i] < num_nodes && tree->child_start[i] <= tree->child_start[i + 1];
+  }
+  for (int32_t i = 0; ok && i < count - 1; ++i) {
+    ok = tree->children[i] > 0 && tree->children[i] < num_nodes;
+  }
+  if (!ok) {
+    in->fail();
+    delete tree;
+    return NULL;
+  }
+
+  // Every node but the root that was reached has an idom
+  tree->objs = new RubyHeapObj*[num_nodes]();
+  for (int32_t i = 0; i < num_nodes; ++i) {
+    if (nodes[i] == root || tree->idoms[i]) {
+      tree->objs[i] = nodes[i];
     }
   }
+  return tree;
 }
 
 }
@@ -5,6 +5,7 @@
 
 #include <vector>
 
+#include "checkpoint.h"
 #include "ruby_heap_obj.h"
 #include "progress.h"
 
@@ -17,20 +18,48 @@ class DominatorTree {
 
     void calculate();
 
-    void retained_size(RubyHeapObj *obj, size_t &size);
+    // Writes the calculated tree to a checkpoint
+    void save(Checkpoint::File *out);
 
+    // Reads a tree written by save() for the graph whose nodes (by index)
+    // are nodes. Returns NULL if it doesn't fit the graph.
+    static DominatorTree * restore(Checkpoint::File *in, RubyHeapObj *root, const RubyHeapObjList &nodes);
+
+    // Retained sizes are accumulated bottom-up once the tree is built, so
+    // this is a lookup. Objects not reachable from the root retain only
+    // themselves.
+    size_t get_retained_size(RubyHeapObj *obj) {
+      if (objs[obj->get_index()] == NULL) {
+        return obj->is_root_object() ? 0 : obj->get_memsize();
+      }
+      return retained[obj->get_index()];
+    }
+
+    // NULL for the root and for objects not reachable from it
     RubyHeapObj * get_idom(RubyHeapObj *obj) {
-      auto t = tree[obj->get_index()];
-      return objs[(*t)[0]];
+      int32_t idom = idoms[obj->get_index()];
+      return idom ? objs[idom] : NULL;
     }
 
+    // Appends the objects obj immediately dominates, largest retained size
+    // first
     void get_dominators(RubyHeapObj *obj, std::vector<RubyHeapObj *> &dominators) {
-      auto t = tree[obj->get_index()];
-      for (size_t i = 1; i < t->size(); ++i) {
-        dominators.push_back(objs[(*t)[i]]);
+      uint32_t idx = obj->get_index();
+      for (int32_t i = child_start[idx]; i < child_start[idx + 1]; ++i) {
+        dominators.push_back(objs[children[i]]);
       }
     }
 
+    size_t get_num_children(RubyHeapObj *obj) {
+      uint32_t idx = obj->get_index();
+      return child_start[idx + 1] - child_start[idx];
+    }
+
+    // The i-th largest object obj immediately dominates
+    RubyHeapObj * get_child(RubyHeapObj *obj, size_t i) {
+      return objs[children[child_start[obj->get_index()] + i]];
+    }
+
   private:
     RubyHeapObj *root;
     int32_t num_nodes;
@@ -43,15 +72,27 @@ class DominatorTree {
     int32_t *parent;
     int32_t *dsu;
     RubyHeapObj **objs;
+    size_t *retained;
     std::vector<int32_t> **reverse_graph;
     std::vector<int32_t> **bucket;
-    std::vector<int32_t> **tree;
+
+    // The tree itself, by node index: each node's idom (0 if none), and its
+    // children in children[child_start[idx]..child_start[idx + 1]), sorted
+    // by retained size
+    int32_t *idoms;
+    int32_t *child_start;
+    int32_t *children;
 
     harb::Progress *progress;
 
+    // For restore(): everything starts out NULL
+    DominatorTree(RubyHeapObj *root);
+
     void dfs(RubyHeapObj *node);
     void dfs_child(RubyHeapObj *obj, RubyHeapObj *child);
     void calculate_sdom();
+    void calculate_retained_sizes();
+    void build_children();
     void cleanup_intermediate_state();
 
     int32_t find(int32_t u, int32_t x = 0);
@@ -1,36 +1,113 @@
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <deque>
+
+#include "sparsehash/sparse_hash_set"
+#include "rapidjson/reader.h"
+
+#include "cancellation.h"
+#include "checkpoint.h"
 #include "progress.h"
 #include "graph.h"
 #include "parser.h"
 
 namespace harb {
 
-Graph::Graph(FILE *f) {
-  fseeko(f, 0, SEEK_END);
-  Progress progress("parsing", ftello(f));
-  fseeko(f, 0, SEEK_SET);
-  progress.start();
-
-  parser_ = new Parser(f);
+Graph::Graph(InputStream *in, double sample_rate, StringPool *strings, size_t value_bytes, Checkpoint *checkpoint)
+  : dominator_tree_(NULL), components_(NULL), offsets_(NULL), source_fd_(-1) {
+  parser_ = new Parser(in, strings);
+  parser_->set_sample_rate(sample_rate);
+  parser_->set_value_bytes(value_bytes);
 
   root_ = parser_->create_heap_object(RUBY_T_ROOT);
+  root_->graph = this;
+  nodes_.push_back(NULL);
+  nodes_.push_back(root_);
+
+  // Only a regular file can be read back; compressed ones are weeded out
+  // once the stream has seen the header
+  if (in->get_size() > 0) {
+    offsets_ = new OffsetIndex();
+  }
+
+  bool restored = checkpoint && restore_nodes(checkpoint);
+  if (!restored) {
+    parse(in);
+  }
+
+  // A restored checkpoint only keeps offsets if the dump could be read back
+  if (offsets_ && (restored || in->is_seekable())) {
+    source_fd_ = open(in->get_path(), O_RDONLY);
+  }
+  if (source_fd_ < 0) {
+    delete offsets_;
+    offsets_ = NULL;
+  }
+
+  if (checkpoint && !restored) {
+    save_nodes(checkpoint);
+  }
+
+  if (!checkpoint || !restore_references(checkpoint)) {
+    update_references();
+    if (checkpoint) {
+      save_references(checkpoint);
+    }
+  }
+
+  // Dominance can't be computed from a subset of the graph
+  if (!is_sampled() && (!checkpoint || !restore_dominator_tree(checkpoint))) {
+    build_dominator_tree();
+    if (checkpoint) {
+      save_dominator_tree(checkpoint);
+    }
+  }
+}
+
+void Graph::parse(InputStream *in) {
+  Progress progress("parsing", in->get_size(), Progress::kBytes);
+  progress.start();
 
   parser_->parse([&] (RubyHeapObj *obj) {
     obj->graph = this;
+    assert(obj->get_index() == nodes_.size());
+    nodes_.push_back(obj);
+    if (offsets_) {
+      offsets_->add(obj->get_index(), parser_->get_object_start(),
+          parser_->get_position() - parser_->get_object_start());
+    }
     if (obj->is_root_object()) {
       root_->as.root.children->push_back(obj);
     } else {
       heap_map_[obj->as.obj.addr] = obj;
     }
-    progress.update(ftello(f));
+    progress.update(in->get_source_position());
   });
 
+  progress.set_items(parser_->get_heap_object_count());
   progress.complete();
+}
 
-  update_references();
-
-  build_dominator_tree();
+Graph::~Graph() {
+  // Only the synthetic root's list of children is allocated
+  delete root_->as.root.children;
+  for (auto obj : nodes_) {
+    if (obj) {
+      delete[] obj->refs_to.addr;
+      delete obj;
+    }
+  }
+  delete dominator_tree_;
+  delete components_;
+  delete offsets_;
+  delete parser_;
+  if (source_fd_ >= 0) {
+    close(source_fd_);
+  }
 }
 
 void Graph::add_inverse_obj_references(RubyHeapObj *obj) {
@@ -85,6 +162,646 @@ void Graph::build_dominator_tree() {
   dominator_tree_->calculate();
 }
 
+// HASH and ARRAY objects keep their size where other objects keep their value
+static inline bool has_value(RubyHeapObj *obj) {
+  return obj->get_type() != RUBY_T_HASH && obj->get_type() != RUBY_T_ARRAY;
+}
+
+// The parsed objects: a string table (ids start at 1, 0 is NULL), the
+// allocation sites, every object but the synthetic root with its references
+// still as addresses, and the objects' offsets in the dump
+void Graph::save_nodes(Checkpoint *checkpoint) {
+  Checkpoint::File *out = checkpoint->create(Checkpoint::kParsed);
+  if (!out) {
+    return;
+  }
+
+  Progress progress("saving parsed objects", nodes_.size());
+  progress.start();
+
+  google::sparse_hash_map<const char *, uint64_t> prefix_hashes;
+  parser_->get_strings()->each_prefix([&] (uint64_t hash, const char *prefix) {
+    prefix_hashes[prefix] = hash;
+  });
+
+  google::sparse_hash_map<const char *, uint32_t> string_ids;
+  std::vector<const char *> strings;
+  auto add_string = [&] (const char *str) {
+    if (str && string_ids.find(str) == string_ids.end()) {
+      strings.push_back(str);
+      string_ids[str] = strings.size();
+    }
+  };
+  auto get_string_id = [&] (const char *str) -> uint32_t {
+    return str ? string_ids[str] : 0;
+  };
+
+  size_t num_sites = parser_->get_alloc_site_count();
+  for (size_t i = 1; i < num_sites; ++i) {
+    add_string(parser_->get_alloc_site(i).file);
+    add_string(parser_->get_alloc_site(i).method);
+  }
+  for (size_t i = 2; i < nodes_.size(); ++i) {
+    RubyHeapObj *obj = nodes_[i];
+    if (obj->is_root_object()) {
+      add_string(obj->as.root.name);
+    } else if (has_value(obj)) {
+      add_string(obj->as.obj.as.value);
+    }
+  }
+
+  out->write((uint32_t) nodes_.size());
+  out->write((uint32_t) strings.size());
+  for (auto str : strings) {
+    auto it = prefix_hashes.find(str);
+    uint32_t length = strlen(str);
+    out->write((uint8_t) (it != prefix_hashes.end()));
+    if (it != prefix_hashes.end()) {
+      out->write(it->second);
+    }
+    out->write(length);
+    out->write(str, length);
+  }
+
+  out->write((uint32_t) num_sites);
+  for (size_t i = 1; i < num_sites; ++i) {
+    const AllocSite &site = parser_->get_alloc_site(i);
+    out->write(get_string_id(site.file));
+    out->write(site.line);
+    out->write(get_string_id(site.method));
+  }
+
+  for (size_t i = 2; i < nodes_.size(); ++i) {
+    RubyHeapObj *obj = nodes_[i];
+    out->write(obj->flags);
+    if (obj->is_root_object()) {
+      out->write(get_string_id(obj->as.root.name));
+    } else {
+      out->write(obj->as.obj.addr);
+      out->write(obj->as.obj.clazz.addr);
+      out->write((uint64_t) obj->as.obj.memsize);
+      out->write(has_value(obj) ? get_string_id(obj->as.obj.as.value) : obj->as.obj.as.size);
+      out->write(obj->as.obj.alloc_site);
+      out->write(obj->as.obj.generation);
+    }
+
+    // The length including the terminating 0, or 0 for no references
+    uint32_t num_refs = 0;
+    if (obj->refs_to.addr) {
+      while (obj->refs_to.addr[num_refs]) {
+        num_refs++;
+      }
+      out->write(num_refs + 1);
+      out->write(obj->refs_to.addr, num_refs);
+    } else {
+      out->write(num_refs);
+    }
+    progress.increment();
+  }
+
+  out->write((uint8_t) (offsets_ != NULL));
+  if (offsets_) {
+    for (size_t i = 2; i < nodes_.size(); ++i) {
+      uint64_t offset = 0, length = 0;
+      offsets_->get(i, offset, length);
+      out->write(offset);
+      out->write(length);
+    }
+  }
+
+  progress.complete();
+  checkpoint->close(out);
+}
+
+bool Graph::restore_nodes(Checkpoint *checkpoint) {
+  Checkpoint::File *in = checkpoint->open(Checkpoint::kParsed);
+  if (!in) {
+    return false;
+  }
+
+  uint32_t num_nodes = in->read<uint32_t>();
+  Progress progress("restoring parsed objects", num_nodes);
+  progress.start();
+
+  StringPool *strings = parser_->get_strings();
+  std::vector<const char *> string_ids(1, NULL);
+  uint32_t num_strings = in->read<uint32_t>();
+  std::string str;
+  for (uint32_t i = 0; i < num_strings && in->is_ok(); ++i) {
+    bool truncated = in->read<uint8_t>();
+    uint64_t hash = truncated ? in->read<uint64_t>() : 0;
+    uint32_t length = in->read<uint32_t>();
+    if (!in->can_read(length, 1)) {
+      break;
+    }
+    str.resize(length);
+    in->read(&str[0], str.size());
+    string_ids.push_back(truncated ? strings->intern_prefix(str.c_str(), hash) : strings->intern(str.c_str()));
+  }
+  auto get_string = [&] (uint32_t id) -> const char * {
+    if (id >= string_ids.size()) {
+      in->fail();
+      return NULL;
+    }
+    return string_ids[id];
+  };
+
+  // Sites are only added once everything has been read, so a damaged
+  // checkpoint leaves the parser as it was
+  std::vector<AllocSite> sites;
+  uint32_t num_sites = in->read<uint32_t>();
+  for (uint32_t i = 1; i < num_sites && in->is_ok(); ++i) {
+    AllocSite site;
+    site.file = get_string(in->read<uint32_t>());
+    site.line = in->read<uint32_t>();
+    site.method = get_string(in->read<uint32_t>());
+    sites.push_back(site);
+  }
+
+  for (uint32_t i = 2; i < num_nodes && in->is_ok(); ++i) {
+    RubyHeapObj *obj = parser_->create_heap_object(RUBY_T_NONE);
+    obj->graph = this;
+    nodes_.push_back(obj);
+
+    obj->flags = in->read<uint32_t>();
+    if (obj->is_root_object()) {
+      obj->as.root.name = get_string(in->read<uint32_t>());
+      root_->as.root.children->push_back(obj);
+    } else {
+      obj->as.obj.addr = in->read<uint64_t>();
+      obj->as.obj.clazz.addr = in->read<uint64_t>();
+      obj->as.obj.memsize = in->read<uint64_t>();
+      if (has_value(obj)) {
+        obj->as.obj.as.value = get_string(in->read<uint32_t>());
+      } else {
+        obj->as.obj.as.size = in->read<uint32_t>();
+      }
+      obj->as.obj.alloc_site = in->read<uint32_t>();
+      obj->as.obj.generation = in->read<uint32_t>();
+      if (obj->as.obj.alloc_site >= num_sites) {
+        in->fail();
+      }
+      heap_map_[obj->as.obj.addr] = obj;
+    }
+
+    uint32_t num_refs = in->read<uint32_t>();
+    if (num_refs && in->can_read(num_refs - 1, sizeof(uint64_t))) {
+      obj->refs_to.addr = new uint64_t[num_refs];
+      in->read(obj->refs_to.addr, num_refs - 1);
+      obj->refs_to.addr[num_refs - 1] = 0;
+    }
+    progress.increment();
+  }
+
+  bool has_offsets = in->read<uint8_t>();
+  for (uint32_t i = 2; has_offsets && i < num_nodes && in->is_ok(); ++i) {
+    uint64_t offset = in->read<uint64_t>();
+    uint64_t length = in->read<uint64_t>();
+    if (offsets_ && length) {
+      offsets_->add(i, offset, length);
+    }
+  }
+
+  if (nodes_.size() != num_nodes) {
+    in->fail();
+  }
+  if (!checkpoint->close(in)) {
+    discard_nodes();
+    return false;
+  }
+
+  for (auto &site : sites) {
+    parser_->add_alloc_site(site);
+  }
+  if (!has_offsets) {
+    delete offsets_;
+    offsets_ = NULL;
+  }
+
+  progress.set_items(num_nodes);
+  progress.complete();
+  return true;
+}
+
+// Throws away the objects of a damaged checkpoint, so the dump can be
+// parsed instead
+void Graph::discard_nodes() {
+  for (size_t i = 2; i < nodes_.size(); ++i) {
+    delete[] nodes_[i]->refs_to.addr;
+    delete nodes_[i];
+  }
+  nodes_.resize(2);
+  root_->as.root.children->clear();
+  heap_map_.clear();
+  parser_->discard_heap_objects(1);
+  if (offsets_) {
+    delete offsets_;
+    offsets_ = new OffsetIndex();
+  }
+}
+
+// The resolved references (and classes) as node indexes, in the order
+// update_references() resolved them
+void Graph::save_references(Checkpoint *checkpoint) {
+  Checkpoint::File *out = checkpoint->create(Checkpoint::kReferences);
+  if (!out) {
+    return;
+  }
+
+  RubyHeapObjList *roots = root_->as.root.children;
+  Progress progress("saving references", heap_map_.size() + roots->size());
+  progress.start();
+
+  std::vector<uint32_t> refs;
+  auto save = [&] (RubyHeapObj *obj) {
+    RubyHeapObj *clazz = obj->as.obj.clazz.obj;
+    refs.clear();
+    for (size_t i = 0; obj->refs_to.obj && obj->refs_to.obj[i]; ++i) {
+      refs.push_back(obj->refs_to.obj[i]->idx);
+    }
+    out->write(obj->idx);
+    out->write(clazz ? clazz->idx : 0);
+    out->write((uint32_t) refs.size());
+    out->write(refs.data(), refs.size());
+    progress.increment();
+  };
+
+  out->write((uint32_t) nodes_.size());
+  out->write((uint32_t) (heap_map_.size() + roots->size()));
+  for (auto it = heap_map_.begin(); it != heap_map_.end(); ++it) {
+    save(it->second);
+  }
+  for (auto it = roots->begin(); it != roots->end(); ++it) {
+    save(*it);
+  }
+
+  progress.complete();
+  checkpoint->close(out);
+}
+
+bool Graph::restore_references(Checkpoint *checkpoint) {
+  Checkpoint::File *in = checkpoint->open(Checkpoint::kReferences);
+  if (!in) {
+    return false;
+  }
+
+  size_t num_nodes = nodes_.size();
+  size_t num_objs = heap_map_.size() + root_->as.root.children->size();
+  if (in->read<uint32_t>() != num_nodes || in->read<uint32_t>() != num_objs) {
+    in->fail();
+  }
+
+  Progress progress("restoring references", num_objs);
+  progress.start();
+
+  // Everything is read and checked before any object is changed, since
+  // the addresses being replaced are needed to redo the phase
+  std::vector<uint32_t> objs, classes, ref_start(1, 0), refs;
+  for (size_t i = 0; i < num_objs && in->is_ok(); ++i) {
+    uint32_t idx = in->read<uint32_t>();
+    uint32_t clazz = in->read<uint32_t>();
+    uint32_t num_refs = in->read<uint32_t>();
+    if (idx < 2 || idx >= num_nodes || clazz >= num_nodes) {
+      in->fail();
+      break;
+    }
+
+    size_t num_addrs = 0;
+    while (nodes_[idx]->refs_to.addr && nodes_[idx]->refs_to.addr[num_addrs]) {
+      num_addrs++;
+    }
+    if (num_refs > num_addrs) {
+      in->fail();
+      break;
+    }
+
+    objs.push_back(idx);
+    classes.push_back(clazz);
+    refs.resize(ref_start.back() + num_refs);
+    in->read(&refs[ref_start.back()], num_refs);
+    ref_start.push_back(refs.size());
+  }
+  for (auto ref : refs) {
+    if (ref < 2 || ref >= num_nodes) {
+      in->fail();
+      break;
+    }
+  }
+
+  if (!checkpoint->close(in)) {
+    return false;
+  }
+
+  for (size_t i = 0; i < objs.size(); ++i) {
+    RubyHeapObj *obj = nodes_[objs[i]];
+    size_t count = ref_start[i + 1] - ref_start[i];
+    if (obj->refs_to.addr) {
+      for (size_t j = 0; j < count; ++j) {
+        obj->refs_to.obj[j] = nodes_[refs[ref_start[i] + j]];
+      }
+      for (size_t j = count; obj->refs_to.addr[j]; ++j) {
+        obj->refs_to.addr[j] = 0;
+      }
+    }
+    obj->as.obj.clazz.obj = classes[i] ? nodes_[classes[i]] : NULL;
+  }
+  for (auto idx : objs) {
+    add_inverse_obj_references(nodes_[idx]);
+    progress.increment();
+  }
+
+  progress.complete();
+  return true;
+}
+
+void Graph::save_dominator_tree(Checkpoint *checkpoint) {
+  Checkpoint::File *out = checkpoint->create(Checkpoint::kDominators);
+  if (!out) {
+    return;
+  }
+
+  Progress progress("saving dominator tree", nodes_.size());
+  progress.start();
+  dominator_tree_->save(out);
+  progress.update(nodes_.size());
+  progress.complete();
+  checkpoint->close(out);
+}
+
+bool Graph::restore_dominator_tree(Checkpoint *checkpoint) {
+  Checkpoint::File *in = checkpoint->open(Checkpoint::kDominators);
+  if (!in) {
+    return false;
+  }
+
+  Progress progress("restoring dominator tree", nodes_.size());
+  progress.start();
+  DominatorTree *tree = DominatorTree::restore(in, root_, nodes_);
+  if (!checkpoint->close(in)) {
+    delete tree;
+    return false;
+  }
+  dominator_tree_ = tree;
+  progress.update(nodes_.size());
+  progress.complete();
+  return true;
+}
+
+bool Graph::get_raw_json(RubyHeapObj *obj, std::string &json) {
+  uint64_t offset, length;
+  if (!offsets_ || !offsets_->get(obj->get_index(), offset, length)) {
+    errno = ENOENT;
+    return false;
+  }
+
+  json.resize(length);
+  size_t done = 0;
+  while (done < length) {
+    ssize_t r = pread(source_fd_, &json[done], length - done, offset + done);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      if (r == 0) {
+        errno = EIO;
+      }
+      return false;
+    }
+    done += r;
+  }
+  return true;
+}
+
+bool Graph::get_full_value(RubyHeapObj *obj, std::string &value) {
+  if (!(obj->flags & RUBY_FL_TRUNCATED)) {
+    value = obj->get_value() ? obj->get_value() : "";
+    return true;
+  }
+
+  // Picks the top-level "value" out of the object's JSON
+  struct ValueHandler : public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, ValueHandler> {
+    std::string &value;
+    int depth;
+    bool is_value, found;
+
+    ValueHandler(std::string &value) : value(value), depth(0), is_value(false), found(false) {}
+
+    bool Default() { is_value = false; return true; }
+    bool StartObject() { ++depth; return Default(); }
+    bool EndObject(rapidjson::SizeType) { --depth; return true; }
+    bool Key(const char *str, rapidjson::SizeType length, bool) {
+      is_value = depth == 1 && strcmp(str, "value") == 0;
+      return true;
+    }
+    bool String(const char *str, rapidjson::SizeType length, bool) {
+      if (is_value) {
+        value.assign(str, length);
+        found = true;
+      }
+      return Default();
+    }
+  };
+
+  std::string json;
+  if (!get_raw_json(obj, json)) {
+    return false;
+  }
+  ValueHandler handler(value);
+  rapidjson::Reader reader;
+  rapidjson::StringStream stream(json.c_str());
+  if (!reader.Parse(stream, handler) || !handler.found) {
+    errno = EINVAL;
+    return false;
+  }
+  return true;
+}
+
+static bool write_all(int fd, const char *buf, size_t size) {
+  while (size > 0) {
+    ssize_t w = write(fd, buf, size);
+    if (w < 0 && errno == EINTR) {
+      continue;
+    }
+    if (w <= 0) {
+      return false;
+    }
+    buf += w;
+    size -= w;
+  }
+  return true;
+}
+
+// Copies length bytes at offset in `in` to the end of `out`, in the kernel
+// where possible
+static bool copy_range(int in, int out, uint64_t offset, uint64_t length) {
+#ifdef __linux__
+  while (length > 0) {
+    loff_t off = offset;
+    ssize_t r = copy_file_range(in, &off, out, NULL, length, 0);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      if (r == 0 || errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP) {
+        break;
+      }
+      return false;
+    }
+    offset += r;
+    length -= r;
+  }
+#endif
+
+  char buf[1 << 16];
+  while (length > 0) {
+    ssize_t r = pread(in, buf, std::min<uint64_t>(length, sizeof(buf)), offset);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      if (r == 0) {
+        errno = EIO;
+      }
+      return false;
+    }
+    if (!write_all(out, buf, r)) {
+      return false;
+    }
+    offset += r;
+    length -= r;
+  }
+  return true;
+}
+
+bool Graph::extract(RubyHeapObj *obj, const char *path, size_t &count) {
+  struct range_t {
+    uint64_t offset, length;
+  };
+
+  if (!offsets_) {
+    errno = ENOENT;
+    return false;
+  }
+
+  // The dominated subtree, and the classes that label it
+  std::vector<RubyHeapObj *> objs;
+  google::sparse_hash_set<RubyHeapObj *> seen;
+  objs.push_back(obj);
+  for (size_t i = 0; i < objs.size(); ++i) {
+    get_dominators(objs[i], objs);
+  }
+  seen.insert(objs.begin(), objs.end());
+  size_t num_dominated = objs.size();
+  for (size_t i = 0; i < num_dominated; ++i) {
+    RubyHeapObj *clazz = objs[i]->is_root_object() ? NULL : objs[i]->get_class_obj();
+    if (clazz && seen.find(clazz) == seen.end()) {
+      seen.insert(clazz);
+      objs.push_back(clazz);
+    }
+  }
+
+  std::vector<range_t> ranges;
+  for (auto o : objs) {
+    range_t r;
+    if (offsets_->get(o->get_index(), r.offset, r.length)) {
+      ranges.push_back(r);
+    }
+  }
+  count = ranges.size();
+
+  // Objects on consecutive lines are copied in one go
+  std::sort(ranges.begin(), ranges.end(), [] (const range_t &a, const range_t &b) {
+    return a.offset < b.offset;
+  });
+  std::vector<range_t> merged;
+  for (auto &r : ranges) {
+    if (!merged.empty() && merged.back().offset + merged.back().length + 1 == r.offset) {
+      merged.back().length = r.offset + r.length - merged.back().offset;
+    } else {
+      merged.push_back(r);
+    }
+  }
+
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+
+  char root[128];
+  int len = snprintf(root, sizeof(root), "{\"type\":\"ROOT\", \"root\":\"extract\", \"references\":[\"0x%" PRIx64 "\"]}\n",
+      obj->get_addr());
+  bool ok = write_all(fd, root, len);
+  for (size_t i = 0; ok && i < merged.size(); ++i) {
+    ok = copy_range(source_fd_, fd, merged[i].offset, merged[i].length) && write_all(fd, "\n", 1);
+  }
+
+  int err = errno;
+  if (close(fd) != 0 && ok) {
+    return false;
+  }
+  errno = err;
+  return ok;
+}
+
+const std::vector<uint64_t> & Graph::get_sorted_addresses() {
+  if (sorted_addrs_.empty() && !heap_map_.empty()) {
+    sorted_addrs_.reserve(heap_map_.size());
+    for (auto it : heap_map_) {
+      sorted_addrs_.push_back(it.first);
+    }
+    std::sort(sorted_addrs_.begin(), sorted_addrs_.end());
+  }
+  return sorted_addrs_;
+}
+
+bool Graph::get_root_path(RubyHeapObj *obj, RubyHeapObjList &path) {
+  bool found = false;
+  RubyHeapObj *cur = NULL;
+  std::deque<RubyHeapObj *> q;
+  google::sparse_hash_set<RubyHeapObj *> visited;
+  google::sparse_hash_map<RubyHeapObj *, RubyHeapObj *> parent;
+
+  // Breadth first up the referrers, so the first root found is the nearest
+  q.push_back(obj);
+  visited.insert(obj);
+
+  while (!q.empty() && !found && !Cancellation::requested()) {
+    cur = q.front();
+    q.pop_front();
+
+    for (auto ref : cur->refs_from) {
+      if (visited.find(ref) == visited.end()) {
+        visited.insert(ref);
+        parent[ref] = cur;
+        if (ref->is_root_object()) {
+          cur = ref;
+          found = true;
+          break;
+        }
+        q.push_back(ref);
+      }
+    }
+  }
+
+  if (!found || Cancellation::requested()) {
+    return false;
+  }
+
+  path.clear();
+  for (; cur != NULL; cur = parent[cur]) {
+    path.push_back(cur);
+  }
+  return true;
+}
+
+StronglyConnectedComponents * Graph::get_components() {
+  if (!components_) {
+    components_ = new StronglyConnectedComponents(nodes_);
+    components_->calculate();
+  }
+  return components_;
+}
+
 RubyHeapObj* Graph::get_heap_object(uint64_t addr) {
   auto it = heap_map_.find(addr);
   if (it == heap_map_.end()) {
@@ -5,9 +5,13 @@
 
 #include "sparsehash/sparse_hash_map"
 
+#include "checkpoint.h"
+#include "input_stream.h"
 #include "parser.h"
 #include "ruby_heap_obj.h"
 #include "dominator_tree.h"
+#include "offset_index.h"
+#include "scc.h"
 
 namespace harb {
 
@@ -17,34 +21,124 @@ class Graph {
   Parser *parser_;
   RubyHeapObj *root_;
   RubyHeapObjMap heap_map_;
+  RubyHeapObjList nodes_; // indexed by RubyHeapObj::get_index()
   DominatorTree *dominator_tree_;
+  StronglyConnectedComponents *components_;
+  OffsetIndex *offsets_;
+  std::vector<uint64_t> sorted_addrs_;
+  int source_fd_;
 
+  void parse(InputStream *in);
   void add_inverse_obj_references(RubyHeapObj *obj);
   void update_obj_references(RubyHeapObj *obj);
   void update_references();
   void build_dominator_tree();
 
+  // Each phase's checkpoint. A restore returns false if there is no usable
+  // checkpoint, leaving the graph as it was.
+  void save_nodes(Checkpoint *checkpoint);
+  bool restore_nodes(Checkpoint *checkpoint);
+  void discard_nodes();
+  void save_references(Checkpoint *checkpoint);
+  bool restore_references(Checkpoint *checkpoint);
+  void save_dominator_tree(Checkpoint *checkpoint);
+  bool restore_dominator_tree(Checkpoint *checkpoint);
+
 public:
-  Graph(FILE *f);
+  // With a sample_rate below 1 only a subset of the objects is loaded (see
+  // Parser::set_sample_rate) and no dominator tree is built
+  // Strings are interned into `strings` when given, so graphs loaded into
+  // the same session can share them. String values longer than value_bytes
+  // (if not 0) are truncated; see get_full_value. With a checkpoint, each
+  // phase of the load is saved as it completes, and phases that were saved
+  // by an earlier load of the same dump are restored instead of redone.
+  // The graph only reads from `in` while it's being built, so the stream
+  // can be deleted once the constructor returns.
+  Graph(InputStream *in, double sample_rate = 1, StringPool *strings = NULL, size_t value_bytes = 0,
+      Checkpoint *checkpoint = NULL);
+  ~Graph();
+
+  bool is_sampled() { return parser_->get_sample_rate() < 1; }
+
+  double get_inclusion_probability(RubyHeapObj *obj) { return parser_->get_inclusion_probability(obj); }
 
   RubyHeapObj* get_heap_object(uint64_t addr);
 
+  // The synthetic root that holds the dump's ROOT records
+  RubyHeapObj* get_root() { return root_; }
+
+  bool has_dominator_tree() { return dominator_tree_ != NULL; }
+
   RubyHeapObj* get_idom(RubyHeapObj *obj) {
-    return dominator_tree_->get_idom(obj);
+    return dominator_tree_ ? dominator_tree_->get_idom(obj) : NULL;
   }
 
   void get_dominators(RubyHeapObj *obj, std::vector<RubyHeapObj *> &dominators) {
-    return dominator_tree_->get_dominators(obj, dominators);
+    if (dominator_tree_) {
+      dominator_tree_->get_dominators(obj, dominators);
+    }
+  }
+
+  // The objects obj immediately dominates, by index in descending order of
+  // retained size
+  size_t get_num_dominated(RubyHeapObj *obj) {
+    return dominator_tree_ ? dominator_tree_->get_num_children(obj) : 0;
+  }
+
+  RubyHeapObj* get_dominated(RubyHeapObj *obj, size_t i) {
+    return dominator_tree_->get_child(obj, i);
   }
 
   size_t get_retained_size(RubyHeapObj *obj) {
-    size_t size = 0;
-    dominator_tree_->retained_size(obj, size);
-    return size;
+    return dominator_tree_ ? dominator_tree_->get_retained_size(obj) : obj->get_memsize();
   }
 
+  // True when objects' JSON can be read back from the dump, which needs an
+  // uncompressed, regular file
+  bool has_offsets() { return offsets_ != NULL; }
+
+  // Reads obj's JSON from the dump. Returns false and sets errno if it
+  // can't be read.
+  bool get_raw_json(RubyHeapObj *obj, std::string &json);
+
+  // The length string values were truncated to when loading, or 0
+  size_t get_value_bytes() { return parser_->get_value_bytes(); }
+
+  StringPool * get_strings() { return parser_->get_strings(); }
+
+  // The whole value of obj, read back from the dump if it was truncated.
+  // Returns false if it was truncated and the dump can't be read back.
+  bool get_full_value(RubyHeapObj *obj, std::string &value);
+
+  // Writes obj, every object it dominates and their classes to path as a
+  // heap dump of their own, with a ROOT record that references obj. count
+  // gets the number of objects written. Returns false and sets errno on
+  // failure.
+  bool extract(RubyHeapObj *obj, const char *path, size_t &count);
+
+  // A shortest chain of references from a ROOT record to obj, starting with
+  // the ROOT record and ending with obj. Returns false if obj isn't
+  // reachable from a root (or the search was cancelled).
+  bool get_root_path(RubyHeapObj *obj, RubyHeapObjList &path);
+
+  // Reference cycles, computed on first use
+  StronglyConnectedComponents * get_components();
+
+  // Every heap object's address in ascending order, built on first use
+  const std::vector<uint64_t> & get_sorted_addresses();
+
   size_t get_num_heap_objects() { return heap_map_.size(); }
 
+  // The node table: every object (including ROOT records and the synthetic
+  // root) by index. Slot 0 is unused.
+  size_t get_num_nodes() { return nodes_.size(); }
+
+  RubyHeapObj * get_node(size_t idx) { return nodes_[idx]; }
+
+  const AllocSite & get_alloc_site(uint32_t id) { return parser_->get_alloc_site(id); }
+
+  size_t get_alloc_site_count() { return parser_->get_alloc_site_count(); }
+
   template<typename Func> void each_heap_object(Func func) {
     for (auto obj: heap_map_) { func(obj.second); }
   }
@@ -0,0 +1,206 @@
+#include <errno.h>
+
+#include "harb.h"
+#include "graph.h"
+#include "input_stream.h"
+
+using namespace harb;
+
+struct harb_graph {
+  Graph *graph;
+};
+
+// harb_object_t is RubyHeapObj as far as C callers know
+static inline RubyHeapObj *
+obj(harb_object_t *o) {
+  return reinterpret_cast<RubyHeapObj *>(o);
+}
+
+static inline harb_object_t *
+handle(RubyHeapObj *o) {
+  return reinterpret_cast<harb_object_t *>(o);
+}
+
+static_assert(RUBY_T_ROOT == HARB_T_ROOT && RUBY_T_MASK < HARB_NUM_TYPES, "type numbering must match harb.h");
+
+int
+harb_api_version(void) {
+  return HARB_API_VERSION;
+}
+
+harb_graph_t *
+harb_open(const char *path, const harb_load_options_t *options) {
+  InputStream *in = InputStream::open(path);
+  if (!in) {
+    return NULL;
+  }
+
+  double sample_rate = options && options->sample_rate > 0 ? options->sample_rate : 1;
+  size_t value_bytes = options ? options->value_bytes : 0;
+  Graph *graph = new Graph(in, sample_rate, NULL, value_bytes);
+  if (in->get_error()) {
+    int error = in->get_error();
+    delete graph;
+    delete in;
+    errno = error;
+    return NULL;
+  }
+
+  // The graph doesn't need the stream once it's loaded
+  delete in;
+
+  harb_graph_t *g = new harb_graph_t;
+  g->graph = graph;
+  return g;
+}
+
+void
+harb_close(harb_graph_t *g) {
+  if (g) {
+    delete g->graph;
+    delete g;
+  }
+}
+
+size_t
+harb_num_objects(harb_graph_t *g) {
+  return g->graph->get_num_heap_objects();
+}
+
+size_t
+harb_num_nodes(harb_graph_t *g) {
+  return g->graph->get_num_nodes();
+}
+
+harb_object_t *
+harb_node(harb_graph_t *g, size_t index) {
+  return index < g->graph->get_num_nodes() ? handle(g->graph->get_node(index)) : NULL;
+}
+
+harb_object_t *
+harb_root(harb_graph_t *g) {
+  return handle(g->graph->get_root());
+}
+
+harb_object_t *
+harb_lookup(harb_graph_t *g, uint64_t addr) {
+  return handle(g->graph->get_heap_object(addr));
+}
+
+uint32_t
+harb_object_index(harb_object_t *o) {
+  return obj(o)->get_index();
+}
+
+uint64_t
+harb_object_addr(harb_object_t *o) {
+  return obj(o)->is_root_object() ? 0 : obj(o)->get_addr();
+}
+
+int
+harb_object_type(harb_object_t *o) {
+  return obj(o)->get_type();
+}
+
+const char *
+harb_object_type_name(harb_object_t *o) {
+  return RubyHeapObj::get_value_type_string(obj(o)->get_type());
+}
+
+uint32_t
+harb_object_flags(harb_object_t *o) {
+  return obj(o)->get_flags();
+}
+
+size_t
+harb_object_memsize(harb_object_t *o) {
+  return obj(o)->is_root_object() ? 0 : obj(o)->get_memsize();
+}
+
+harb_object_t *
+harb_object_class(harb_object_t *o) {
+  return obj(o)->is_root_object() ? NULL : handle(obj(o)->get_class_obj());
+}
+
+const char *
+harb_object_value(harb_object_t *o) {
+  switch (obj(o)->get_type()) {
+    case RUBY_T_STRING:
+    case RUBY_T_SYMBOL:
+    case RUBY_T_CLASS:
+    case RUBY_T_MODULE:
+    case RUBY_T_DATA:
+    case RUBY_T_IMEMO:
+      return obj(o)->get_value();
+    default:
+      return NULL;
+  }
+}
+
+uint32_t
+harb_object_length(harb_object_t *o) {
+  RubyValueType type = obj(o)->get_type();
+  return type == RUBY_T_HASH || type == RUBY_T_ARRAY ? obj(o)->get_size() : 0;
+}
+
+const char *
+harb_object_root_name(harb_object_t *o) {
+  return obj(o)->is_root_object() ? obj(o)->get_root_name() : NULL;
+}
+
+size_t
+harb_object_refs_to(harb_object_t *o, harb_object_t *const **refs) {
+  RubyHeapObj * const *array = obj(o)->get_refs_to_array();
+  size_t count = 0;
+  while (array && array[count]) {
+    ++count;
+  }
+  *refs = reinterpret_cast<harb_object_t *const *>(array);
+  return count;
+}
+
+size_t
+harb_object_refs_from(harb_object_t *o, harb_object_t *const **refs) {
+  const RubyHeapObjList *list = obj(o)->get_refs_from();
+  *refs = reinterpret_cast<harb_object_t *const *>(list->data());
+  return list->size();
+}
+
+int
+harb_has_dominator_tree(harb_graph_t *g) {
+  return g->graph->has_dominator_tree();
+}
+
+harb_object_t *
+harb_idom(harb_graph_t *g, harb_object_t *o) {
+  return handle(g->graph->get_idom(obj(o)));
+}
+
+size_t
+harb_retained_size(harb_graph_t *g, harb_object_t *o) {
+  return g->graph->get_retained_size(obj(o));
+}
+
+size_t
+harb_rootpath(harb_graph_t *g, harb_object_t *o, harb_object_t **path, size_t max) {
+  RubyHeapObjList chain;
+  if (!g->graph->get_root_path(obj(o), chain)) {
+    return 0;
+  }
+  for (size_t i = 0; i < chain.size() && i < max; ++i) {
+    path[i] = handle(chain[i]);
+  }
+  return chain.size();
+}
+
+void
+harb_summary(harb_graph_t *g, harb_type_summary_t summary[HARB_NUM_TYPES]) {
+  for (int i = 0; i < HARB_NUM_TYPES; ++i) {
+    summary[i].count = summary[i].memsize = 0;
+  }
+  g->graph->each_heap_object([&] (RubyHeapObj *o) {
+    harb_type_summary_t &s = summary[o->get_type()];
+    s.count++;
+    s.memsize += o->get_memsize();
+  });
+}
@@ -0,0 +1,110 @@
+#ifndef HARB_H
+#define HARB_H
+
+/*
+ * C API for loading Ruby heap dumps (from ObjectSpace.dump_all) and querying
+ * them in process, for use from C and from other languages over FFI.
+ *
+ * Objects are pointers into the graph's node table and stay valid until the
+ * graph is closed. Strings returned by the accessors are owned by the graph
+ * too. Functions that return arrays of objects return pointers into the
+ * graph rather than copies.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HARB_API_VERSION 1
+
+typedef struct harb_graph harb_graph_t;
+typedef struct harb_object harb_object_t;
+
+typedef struct harb_load_options {
+  /* Load only this fraction of the objects (see harb --sample); 0 or 1 loads
+     everything. Sampled graphs have no dominator tree. */
+  double sample_rate;
+  /* Keep only this many bytes of longer string values (see harb
+     --value-bytes); 0 keeps them whole */
+  size_t value_bytes;
+} harb_load_options_t;
+
+/* Totals for the objects of one type, see harb_summary */
+typedef struct harb_type_summary {
+  size_t count;
+  size_t memsize;
+} harb_type_summary_t;
+
+/* Object types, the same values as Ruby's T_* constants */
+#define HARB_NUM_TYPES 32
+#define HARB_T_ROOT 0x1f
+
+/* The HARB_API_VERSION the library was built with */
+int harb_api_version(void);
+
+/* Loads the dump at path, which may be gzip compressed. options may be NULL.
+   Returns NULL and sets errno on failure. */
+harb_graph_t *harb_open(const char *path, const harb_load_options_t *options);
+
+void harb_close(harb_graph_t *graph);
+
+/* Number of heap objects, not counting ROOT records */
+size_t harb_num_objects(harb_graph_t *graph);
+
+/* The node table: every object, ROOT record and the synthetic root by
+   index, for 1 <= index < harb_num_nodes(). Some slots may be NULL. */
+size_t harb_num_nodes(harb_graph_t *graph);
+harb_object_t *harb_node(harb_graph_t *graph, size_t index);
+
+/* The synthetic root, which references every ROOT record */
+harb_object_t *harb_root(harb_graph_t *graph);
+
+/* The object at addr, or NULL */
+harb_object_t *harb_lookup(harb_graph_t *graph, uint64_t addr);
+
+uint32_t harb_object_index(harb_object_t *obj);
+uint64_t harb_object_addr(harb_object_t *obj);
+int harb_object_type(harb_object_t *obj);
+const char *harb_object_type_name(harb_object_t *obj);
+/* Type and flag bits (frozen, shared, GC state and so on) */
+uint32_t harb_object_flags(harb_object_t *obj);
+size_t harb_object_memsize(harb_object_t *obj);
+/* The class of OBJECTs and most builtin types, or NULL */
+harb_object_t *harb_object_class(harb_object_t *obj);
+/* String and symbol values, class and module names, DATA struct names and
+   IMEMO types; NULL for other types */
+const char *harb_object_value(harb_object_t *obj);
+/* Number of elements of a HASH or ARRAY; 0 for other types */
+uint32_t harb_object_length(harb_object_t *obj);
+/* The category of a ROOT record, e.g. "vm"; NULL for other objects */
+const char *harb_object_root_name(harb_object_t *obj);
+
+/* Sets *refs to the objects obj references (or is referenced from) and
+   returns how many there are */
+size_t harb_object_refs_to(harb_object_t *obj, harb_object_t *const **refs);
+size_t harb_object_refs_from(harb_object_t *obj, harb_object_t *const **refs);
+
+/* Whether idom and retained sizes are available (not for sampled graphs) */
+int harb_has_dominator_tree(harb_graph_t *graph);
+/* The immediate dominator of obj, or NULL */
+harb_object_t *harb_idom(harb_graph_t *graph, harb_object_t *obj);
+/* Bytes freed if obj were freed; just its memsize without a dominator tree */
+size_t harb_retained_size(harb_graph_t *graph, harb_object_t *obj);
+
+/* Writes up to max objects of a shortest reference chain from a ROOT record
+   to obj into path. Returns the length of the whole chain, or 0 if obj isn't
+   reachable from a root. */
+size_t harb_rootpath(harb_graph_t *graph, harb_object_t *obj, harb_object_t **path, size_t max);
+
+/* Fills summary, indexed by type, with the count and memsize of every object
+   (ROOT records excluded) */
+void harb_summary(harb_graph_t *graph, harb_type_summary_t summary[HARB_NUM_TYPES]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HARB_H */
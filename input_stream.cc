@@ -0,0 +1,324 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include <algorithm>
+
+#include "input_stream.h"
+
+namespace harb {
+
+static const size_t kSourceBufferSize = 1 << 18;
+
+InputStream * InputStream::open(const char *path) {
+  int fd;
+  if (strcmp(path, "-") == 0) {
+    fd = dup(STDIN_FILENO);
+  } else {
+    fd = ::open(path, O_RDONLY);
+  }
+  if (fd < 0) {
+    return NULL;
+  }
+
+  return new InputStream(fd, path, 0, 0);
+}
+
+InputStream * InputStream::open(const char *path, uint64_t begin, uint64_t end) {
+  assert(end > begin);
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  if (lseek(fd, begin, SEEK_SET) < 0) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return NULL;
+  }
+
+  return new InputStream(fd, path, begin, end);
+}
+
+bool InputStream::split(const char *path, size_t n, std::vector<uint64_t> &bounds) {
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat st;
+  unsigned char magic[2];
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 ||
+      pread(fd, magic, sizeof(magic), 0) != sizeof(magic) || (magic[0] == 0x1f && magic[1] == 0x8b)) {
+    close(fd);
+    return false;
+  }
+
+  uint64_t size = st.st_size;
+  bounds.clear();
+  bounds.push_back(0);
+  char buf[4096];
+  for (size_t i = 1; i < n; ++i) {
+    uint64_t pos = std::max(bounds.back(), size * i / n);
+    bool found = false;
+    while (!found && pos < size) {
+      ssize_t r = pread(fd, buf, sizeof(buf), pos);
+      if (r <= 0) {
+        break;
+      }
+      char *nl = (char *) memchr(buf, '\n', r);
+      if (nl) {
+        pos += nl - buf + 1;
+        found = true;
+      } else {
+        pos += r;
+      }
+    }
+    if (!found || pos >= size) {
+      break;
+    }
+    if (pos > bounds.back()) {
+      bounds.push_back(pos);
+    }
+  }
+  bounds.push_back(size);
+
+  close(fd);
+  return true;
+}
+
+InputStream::InputStream(int fd, const char *path, uint64_t begin, uint64_t end)
+  : fd_(fd), path_(path), compressed_(false), regular_file_(false), size_(0),
+    remaining_(end > 0 ? end - begin : UINT64_MAX), source_position_(0),
+    head_(0), tail_(0), filled_(0), source_eof_(false), stopping_(false), error_(0), reader_(NULL),
+    read_count_(0), count_(begin), eof_(false), holding_chunk_(false),
+    capturing_(false), capture_from_(NULL) {
+  struct stat st;
+  if (fstat(fd_, &st) == 0 && S_ISREG(st.st_mode)) {
+    regular_file_ = true;
+    size_ = end > 0 ? end - begin : st.st_size;
+  }
+
+  for (size_t i = 0; i < kNumChunks; ++i) {
+    chunks_[i].data = new char[kChunkSize + 1];
+    chunks_[i].size = 0;
+  }
+
+  eof_buffer_[0] = '\0';
+  buffer_ = buffer_last_ = current_ = eof_buffer_;
+
+  reader_ = new std::thread(&InputStream::run_reader, this);
+
+  next_chunk();
+}
+
+InputStream::~InputStream() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cond_.notify_all();
+  reader_->join();
+  delete reader_;
+
+  for (size_t i = 0; i < kNumChunks; ++i) {
+    delete[] chunks_[i].data;
+  }
+
+  close(fd_);
+}
+
+// A single read(2) from the source, limited to the range being read
+ssize_t InputStream::read_source(char *dst, size_t size) {
+  if (remaining_ == 0) {
+    return 0;
+  }
+  if (size > remaining_) {
+    size = remaining_;
+  }
+
+  ssize_t r;
+  do {
+    r = ::read(fd_, dst, size);
+  } while (r < 0 && errno == EINTR);
+
+  if (r < 0) {
+    error_ = errno;
+  } else if (r > 0) {
+    remaining_ -= r;
+    source_position_.fetch_add(r, std::memory_order_relaxed);
+  }
+  return r;
+}
+
+// Reads up to size bytes from the source into dst, draining any bytes that
+// were read ahead (while sniffing the header) first.
+size_t InputStream::fill_plain(char *dst, size_t size, char *pending, size_t &pending_size) {
+  size_t n = 0;
+  if (pending_size > 0) {
+    n = std::min(size, pending_size);
+    memcpy(dst, pending, n);
+    memmove(pending, pending + n, pending_size - n);
+    pending_size -= n;
+  }
+
+  while (n < size) {
+    ssize_t r = read_source(dst + n, size - n);
+    if (r <= 0) {
+      break;
+    }
+    n += r;
+  }
+  return n;
+}
+
+void InputStream::run_reader() {
+  char *in = new char[kSourceBufferSize];
+  size_t in_size = 0;
+  bool in_eof = false;
+
+  // Sniff the gzip magic before deciding how to fill chunks
+  while (in_size < 2 && !in_eof) {
+    ssize_t r = read_source(in + in_size, kSourceBufferSize - in_size);
+    if (r <= 0) {
+      in_eof = true;
+      break;
+    }
+    in_size += r;
+  }
+  compressed_ = in_size >= 2 && (unsigned char) in[0] == 0x1f && (unsigned char) in[1] == 0x8b;
+
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if (compressed_) {
+    // 15 + 32: maximum window, detect the gzip/zlib header automatically
+    if (inflateInit2(&zs, 15 + 32) != Z_OK) {
+      error_ = EIO;
+      in_eof = true;
+      in_size = 0;
+    }
+    zs.next_in = (Bytef *) in;
+    zs.avail_in = in_size;
+  }
+
+  bool done = false;
+  while (!done) {
+    size_t slot;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [&] { return stopping_ || filled_ < kNumChunks; });
+      if (stopping_) {
+        break;
+      }
+      slot = head_;
+    }
+
+    Chunk &chunk = chunks_[slot];
+    size_t n = 0;
+
+    if (!compressed_) {
+      n = in_eof && in_size == 0 ? 0 : fill_plain(chunk.data, kChunkSize, in, in_size);
+      done = n < kChunkSize;
+    } else {
+      zs.next_out = (Bytef *) chunk.data;
+      zs.avail_out = kChunkSize;
+      while (zs.avail_out > 0) {
+        if (zs.avail_in == 0) {
+          if (in_eof) {
+            done = true;
+            break;
+          }
+          ssize_t r = read_source(in, kSourceBufferSize);
+          if (r <= 0) {
+            in_eof = true;
+            continue;
+          }
+          zs.next_in = (Bytef *) in;
+          zs.avail_in = r;
+        }
+
+        int ret = inflate(&zs, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+          // Concatenated gzip members are valid gzip; keep going
+          inflateReset(&zs);
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+          error_ = EIO;
+          done = true;
+          break;
+        }
+      }
+      n = kChunkSize - zs.avail_out;
+    }
+
+    chunk.size = n;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (n > 0) {
+        head_ = (head_ + 1) % kNumChunks;
+        filled_++;
+      }
+      if (done) {
+        source_eof_ = true;
+      }
+    }
+    cond_.notify_all();
+  }
+
+  if (compressed_) {
+    inflateEnd(&zs);
+  }
+  delete[] in;
+}
+
+void InputStream::next_chunk() {
+  if (capturing_) {
+    capture_.append(capture_from_, buffer_last_ + 1 - capture_from_);
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (holding_chunk_) {
+    tail_ = (tail_ + 1) % kNumChunks;
+    filled_--;
+    holding_chunk_ = false;
+    cond_.notify_all();
+  }
+
+  count_ += read_count_;
+  cond_.wait(lock, [&] { return filled_ > 0 || source_eof_; });
+
+  if (filled_ == 0) {
+    // Mirror FileReadStream: park on a terminating '\0' once the source is done
+    read_count_ = 0;
+    buffer_ = buffer_last_ = current_ = eof_buffer_;
+    eof_ = true;
+  } else {
+    Chunk &chunk = chunks_[tail_];
+    holding_chunk_ = true;
+    read_count_ = chunk.size;
+    buffer_ = current_ = chunk.data;
+    buffer_last_ = buffer_ + read_count_ - 1;
+  }
+
+  capture_from_ = buffer_;
+}
+
+void InputStream::start_capture(const char *prefix) {
+  capture_.assign(prefix);
+  capture_from_ = current_;
+  capturing_ = true;
+}
+
+const std::string & InputStream::end_capture() {
+  if (capturing_) {
+    capture_.append(capture_from_, current_ - capture_from_);
+    capturing_ = false;
+  }
+  return capture_;
+}
+
+}
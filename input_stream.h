@@ -0,0 +1,131 @@
+#ifndef HARB_INPUT_STREAM_H
+#define HARB_INPUT_STREAM_H
+
+#include <assert.h>
+#include <inttypes.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace harb {
+
+// A forward-only rapidjson input stream over a heap dump. The source can be
+// a regular file, a pipe/FIFO (or "-" for stdin), and may be gzip
+// compressed. A reader thread reads (and inflates) the source into a ring of
+// fixed-size chunks that the parser consumes, so I/O and decompression
+// overlap with parsing and the source never needs to be seekable.
+class InputStream {
+  struct Chunk {
+    char *data;
+    size_t size;
+  };
+
+  static const size_t kChunkSize = 1 << 20;
+  static const size_t kNumChunks = 8;
+
+  int fd_;
+  std::string path_;
+  bool compressed_;
+  bool regular_file_;
+  uint64_t size_;
+  uint64_t remaining_; // bytes left to read from the source
+  std::atomic<uint64_t> source_position_;
+
+  // ring buffer shared with the reader thread
+  Chunk chunks_[kNumChunks];
+  size_t head_, tail_, filled_;
+  bool source_eof_, stopping_;
+  int error_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::thread *reader_;
+
+  // consumer state, modelled on rapidjson::FileReadStream
+  char *buffer_;
+  char *buffer_last_;
+  char *current_;
+  size_t read_count_;
+  size_t count_;
+  bool eof_;
+  bool holding_chunk_;
+  char eof_buffer_[1];
+
+  bool capturing_;
+  const char *capture_from_;
+  std::string capture_;
+
+  InputStream(int fd, const char *path, uint64_t begin, uint64_t end);
+
+  void run_reader();
+  ssize_t read_source(char *dst, size_t size);
+  size_t fill_plain(char *dst, size_t size, char *pending, size_t &pending_size);
+  void next_chunk();
+
+  void read() {
+    if (current_ < buffer_last_) {
+      ++current_;
+    } else if (!eof_) {
+      next_chunk();
+    }
+  }
+
+public:
+  typedef char Ch;
+
+  // Opens path for reading ("-" reads from stdin). Returns NULL and sets
+  // errno on failure.
+  static InputStream * open(const char *path);
+
+  // Opens the byte range [begin, end) of a regular, uncompressed file.
+  // Tell() reports offsets into the whole file.
+  static InputStream * open(const char *path, uint64_t begin, uint64_t end);
+
+  // Splits a regular, uncompressed dump into at most n ranges that start
+  // at line boundaries, so each can be parsed independently. bounds gets
+  // the range offsets (ranges are [bounds[i], bounds[i + 1])). Returns
+  // false if path can't be split.
+  static bool split(const char *path, size_t n, std::vector<uint64_t> &bounds);
+
+  ~InputStream();
+
+  Ch Peek() const { return *current_; }
+  Ch Take() { Ch c = *current_; read(); return c; }
+  size_t Tell() const { return count_ + static_cast<size_t>(current_ - buffer_); }
+
+  Ch* PutBegin() { assert(false); return 0; }
+  void Put(Ch) { assert(false); }
+  void Flush() { assert(false); }
+  size_t PutEnd(Ch*) { assert(false); return 0; }
+
+  const char * get_path() { return path_.c_str(); }
+
+  // Size of the underlying source (or range) in bytes, or 0 if it is not
+  // known (pipes)
+  uint64_t get_size() { return size_; }
+
+  // Bytes consumed from the underlying source so far. For compressed input
+  // this is the compressed position, so it can be compared with get_size().
+  uint64_t get_source_position() { return source_position_.load(std::memory_order_relaxed); }
+
+  bool is_compressed() { return compressed_; }
+
+  // True when stream offsets (Tell()) are offsets into a regular file that
+  // can be read back with pread()
+  bool is_seekable() { return regular_file_ && !compressed_; }
+
+  int get_error() { return error_; }
+
+  // Captures the raw bytes consumed between start_capture() and
+  // end_capture(). The prefix is prepended, since the parser only learns an
+  // object has started once its first character has been taken.
+  void start_capture(const char *prefix);
+  const std::string & end_capture();
+};
+
+}
+
+#endif // HARB_INPUT_STREAM_H
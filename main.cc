@@ -1,32 +1,74 @@
 #include <stdlib.h>
+#include <ctype.h>
+#include <stdarg.h>
 #include <string.h>
 #include <stdio.h>
 #include <inttypes.h>
+#include <math.h>
 #include <sys/types.h>
 #include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/errno.h>
 #include <unistd.h>
 #include <locale.h>
+#include <getopt.h>
+#include <signal.h>
 
 #include <readline/readline.h>
 #include <readline/history.h>
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include "sparsehash/sparse_hash_map"
 #include "sparsehash/sparse_hash_set"
 
+#include "cancellation.h"
+#include "checkpoint.h"
 #include "graph.h"
 #include "ruby_heap_obj.h"
 #include "progress.h"
 #include "output.h"
+#include "parallel.h"
+#include "completion.h"
+#include "reachable.h"
+#include "whatif.h"
+#include "query.h"
+#include "result_cache.h"
+#include "string_pool.h"
+#include "summary.h"
 
 using namespace harb;
 
 bool exit_ = false;
 FILE *out_ = stdout;
 Graph *graph_;
+Completer *completer_;
+
+// A dump loaded into the session. The dump named on the command line is "a";
+// `load` adds more and `use` picks the one graph_ and completer_ refer to.
+typedef struct loaded_graph {
+  Graph *graph;
+  Completer *completer;
+  std::string filename;
+} loaded_graph_t;
+
+std::map<std::string, loaded_graph_t> graphs_;
+std::string graph_name_;
+// Shared by every loaded graph, so class names can be matched by pointer
+StringPool *strings_;
+// String values longer than this are truncated (0 keeps them whole)
+size_t value_bytes_ = 0;
+// Results of rootpath, path, reachable and contents, by object
+ResultCache *cache_;
 
 static void
 fatal_error(const char *fmt, ...) {
@@ -38,6 +80,23 @@ fatal_error(const char *fmt, ...) {
   exit(-1);
 }
 
+static void
+split_args(const char *args, std::vector<std::string> &argv) {
+  while (args && *args) {
+    while (*args == ' ') {
+      args++;
+    }
+    const char *end = args;
+    while (*end != ' ' && *end != '\0') {
+      end++;
+    }
+    if (end > args) {
+      argv.push_back(std::string(args, end - args));
+    }
+    args = end;
+  }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Commands
 ///////////////////////////////////////////////////////////////////////////////
@@ -54,222 +113,2265 @@ static void cmd_print(const char *);
 static void cmd_rootpath(const char *);
 static void cmd_idom(const char *);
 static void cmd_dominators(const char *);
+static void cmd_tree(const char *);
 static void cmd_summary(const char *);
 static void cmd_diff(const char *);
+static void cmd_allocsites(const char *);
+static void cmd_generations(const char *);
+static void cmd_pages(const char *);
+static void cmd_roots(const char *);
+static void cmd_top(const char *);
+static void cmd_classes(const char *);
+static void cmd_cycles(const char *);
+static void cmd_path(const char *);
+static void cmd_reachable(const char *);
+static void cmd_whatif(const char *);
+static void cmd_raw(const char *);
+static void cmd_extract(const char *);
+static void cmd_export_flame(const char *);
+static void cmd_classgraph(const char *);
+static void cmd_find(const char *);
+static void cmd_cache(const char *);
+static void cmd_collections(const char *);
+static void cmd_contents(const char *);
+static void cmd_load(const char *);
+static void cmd_use(const char *);
+static void cmd_graphs(const char *);
+static void cmd_compare(const char *);
 
 command_t commands_[] = {
   { "quit", cmd_quit, "Exits the program" },
   { "print", cmd_print, "Prints heap info for the address specified" },
   { "rootpath", cmd_rootpath, "Display the root path for the object specified" },
+  { "roots", cmd_roots, "Display retained memory per root category, with the top [n] objects in each" },
+  { "path", cmd_path, "Display the shortest reference path <from> <to>" },
+  { "reachable", cmd_reachable, "Display the count and memsize of everything reachable from the object specified" },
+  { "whatif", cmd_whatif, "Display what would be freed by: drop <addr> | drop-edge <from> <to>" },
+  { "raw", cmd_raw, "Print the JSON for the object specified from the dump" },
+  { "extract", cmd_extract, "Write <addr> and everything it dominates to <file> as a heap dump" },
+  { "export-flame", cmd_export_flame, "Write the dominator tree to <file> as folded stacks [--min-bytes N]" },
+  { "collections", cmd_collections, "Display the [n] largest hashes and arrays by length and by retained size" },
+  { "contents", cmd_contents, "Summarize by class what the object specified references and dominates" },
+  { "find", cmd_find, "Find objects matching a query, e.g. type = STRING and memsize > 1000 group by class" },
+  { "classgraph", cmd_classgraph, "Display the [n] heaviest class to class references [--min-bytes N] [--dot file]" },
   { "idom", cmd_idom, "Print the immediate dominator for the object specified" },
   { "dominators", cmd_dominators, "Print all objects dominated by the object specified" },
+  { "tree", cmd_tree, "Browse the dominator tree: [addr|1.2|..|/|.] [depth] [n]" },
   { "help", cmd_help, "Displays this message"},
+  { "cache", cmd_cache, "Show or change the result cache: stats | clear | size <MB>" },
   { "summary", cmd_summary, "Display a heap dump summary" },
   { "diff", cmd_diff, "Diff current heap dump with specifed dump" },
+  { "load", cmd_load, "Load the dump <file> into the session as <name>" },
+  { "use", cmd_use, "Switch the current dump to the one loaded as <name>" },
+  { "graphs", cmd_graphs, "List the dumps loaded into the session" },
+  { "compare", cmd_compare, "Compare retained sizes of matching objects in the current dump and <name> [n]" },
+  { "allocsites", cmd_allocsites, "Display the top [n] allocation sites by memsize" },
+  { "generations", cmd_generations, "Display object counts and memsize per GC generation" },
+  { "pages", cmd_pages, "Display heap page occupancy [n] [--page-size N] [--slot-sizes 40,80,...]" },
+  { "top", cmd_top, "Display the top [n] objects by retained size [--by memsize] [--older-than <gen>]" },
+  { "classes", cmd_classes, "Display the top [n] classes by memsize" },
+  { "cycles", cmd_cycles, "Display the [n] largest reference cycles by memsize" },
   { NULL, NULL, NULL }
 };
 
+// Horvitz-Thompson estimate of a count and a memsize total from the loaded
+// objects, each weighted by the inverse of its inclusion probability. When
+// the graph isn't sampled every probability is 1, the estimate is exact and
+// the variance is 0.
+typedef struct estimate {
+  double count, count_var;
+  double memsize, memsize_var;
+
+  estimate() : count(0), count_var(0), memsize(0), memsize_var(0) {}
+
+  void add(RubyHeapObj *obj) {
+    double p = graph_->get_inclusion_probability(obj);
+    double y = obj->get_memsize();
+    count += 1 / p;
+    count_var += (1 - p) / (p * p);
+    memsize += y / p;
+    memsize_var += (1 - p) * y * y / (p * p);
+  }
+
+  void merge(const struct estimate &other) {
+    count += other.count;
+    count_var += other.count_var;
+    memsize += other.memsize;
+    memsize_var += other.memsize_var;
+  }
+
+  // Half-widths of the 95% confidence intervals
+  double count_ci() const { return 1.96 * sqrt(count_var); }
+  double memsize_ci() const { return 1.96 * sqrt(memsize_var); }
+} estimate_t;
+
+static void
+print_estimate(FILE *out, double value, double ci) {
+  if (graph_->is_sampled()) {
+    fprintf(out, "~%'.0f (±%'.0f)", value, ci);
+  } else {
+    fprintf(out, "%'.0f", value);
+  }
+}
+
 static void
 cmd_summary(const char *) {
-  typedef google::sparse_hash_map<uint32_t, size_t> type_map_t;
+  typedef google::sparse_hash_map<uint32_t, estimate_t> type_map_t;
   type_map_t type_map;
-  size_t total_size = 0;
-  size_t num_heap_objects = graph_->get_num_heap_objects();
+  estimate_t total;
 
   graph_->each_heap_object([&] (RubyHeapObj *obj) {
-    total_size += obj->get_memsize();
-    uint32_t type = obj->get_type();
-    if (type_map[type]) {
-      type_map[type] += obj->get_memsize();
+    total.add(obj);
+    type_map[obj->get_type()].add(obj);
+  });
+
+  if (graph_->is_sampled()) {
+    fprintf(out_, "estimated from %'zu sampled objects, 95%% confidence intervals\n",
+        graph_->get_num_heap_objects());
+  }
+  fprintf(out_, "total objects: ");
+  print_estimate(out_, total.count, total.count_ci());
+  fprintf(out_, "\ntotal heap memsize: ");
+  print_estimate(out_, total.memsize, total.memsize_ci());
+  fprintf(out_, " bytes\n");
+  for (auto it : type_map) {
+    fprintf(out_, "  %s: ", RubyHeapObj::get_value_type_string(it.first));
+    print_estimate(out_, it.second.memsize, it.second.memsize_ci());
+    fprintf(out_, " bytes\n");
+  }
+}
+
+static void
+cmd_classes(const char *args) {
+  typedef google::sparse_hash_map<RubyHeapObj *, estimate_t> class_map_t;
+
+  size_t limit = 20;
+  if (args && *args) {
+    limit = strtoul(args, NULL, 0);
+  }
+
+  size_t num_nodes = graph_->get_num_nodes();
+  std::vector<class_map_t> thread_stats(parallel_num_threads(num_nodes));
+
+  parallel_for(num_nodes, [&] (size_t begin, size_t end, size_t thread) {
+    class_map_t &stats = thread_stats[thread];
+    for (size_t i = begin; i < end; ++i) {
+      RubyHeapObj *obj = graph_->get_node(i);
+      if (!obj || obj->is_root_object() || !obj->get_class_obj()) {
+        continue;
+      }
+      stats[obj->get_class_obj()].add(obj);
+    }
+  });
+
+  class_map_t &totals = thread_stats[0];
+  for (size_t t = 1; t < thread_stats.size(); ++t) {
+    for (auto it : thread_stats[t]) {
+      totals[it.first].merge(it.second);
+    }
+  }
+
+  std::vector<std::pair<RubyHeapObj *, estimate_t>> classes(totals.begin(), totals.end());
+  limit = std::min(limit, classes.size());
+  std::partial_sort(classes.begin(), classes.begin() + limit, classes.end(),
+      [] (const std::pair<RubyHeapObj *, estimate_t> &a, const std::pair<RubyHeapObj *, estimate_t> &b) {
+    return a.second.memsize > b.second.memsize;
+  });
+
+  Output::with_handle([&](FILE *out) {
+    fprintf(out, "top %zu of %'zu classes by memsize%s:\n", limit, classes.size(),
+        graph_->is_sampled() ? " (estimated, 95% confidence intervals)" : "");
+    if (graph_->is_sampled()) {
+      fprintf(out, "%26s %32s  %s\n", "count", "memsize", "class");
     } else {
-      type_map[type] = obj->get_memsize();
+      fprintf(out, "%12s %16s  %s\n", "count", "memsize", "class");
+    }
+    for (size_t i = 0; i < limit; ++i) {
+      estimate_t &e = classes[i].second;
+      const char *name = classes[i].first->get_value();
+      if (graph_->is_sampled()) {
+        fprintf(out, "%'12.0f ±%'12.0f %'16.0f ±%'14.0f", e.count, e.count_ci(), e.memsize, e.memsize_ci());
+      } else {
+        fprintf(out, "%'12.0f %'16.0f", e.count, e.memsize);
+      }
+      if (name) {
+        fprintf(out, "  %s\n", name);
+      } else {
+        fprintf(out, "  0x%" PRIx64 "\n", classes[i].first->get_addr());
+      }
     }
   });
-  fprintf(out_, "total objects: %'zu\n", num_heap_objects);
-  fprintf(out_, "total heap memsize: %'zu bytes\n", total_size);
-  for (auto it : type_map) {
-    fprintf(out_, "  %s: %'zu bytes\n", RubyHeapObj::get_value_type_string(it.first),
-        it.second);
+}
+
+static void
+cmd_cycles(const char *args) {
+  struct class_stats_t {
+    size_t count, memsize;
+  };
+  typedef google::sparse_hash_map<const char *, class_stats_t> class_map_t;
+
+  size_t limit = 10;
+  if (args && *args) {
+    limit = strtoul(args, NULL, 0);
+  }
+
+  StronglyConnectedComponents *components = graph_->get_components();
+  size_t num_components = components->get_num_components();
+
+  std::vector<uint32_t> ids;
+  for (uint32_t i = 1; i <= num_components; ++i) {
+    ids.push_back(i);
+  }
+  limit = std::min(limit, ids.size());
+  std::partial_sort(ids.begin(), ids.begin() + limit, ids.end(), [&] (uint32_t a, uint32_t b) {
+    return components->get_component_info(a).memsize > components->get_component_info(b).memsize;
+  });
+
+  // One pass over the nodes collects the classes of the listed components
+  std::vector<int32_t> rank(num_components + 1, -1);
+  for (size_t i = 0; i < limit; ++i) {
+    rank[ids[i]] = i;
+  }
+  std::vector<class_map_t> classes(limit);
+  for (size_t i = 0; i < graph_->get_num_nodes(); ++i) {
+    RubyHeapObj *obj = graph_->get_node(i);
+    if (!obj || obj->is_root_object() || rank[components->get_component(obj)] < 0) {
+      continue;
+    }
+    const char *name = obj->get_class_obj() ? obj->get_class_obj()->get_value() : NULL;
+    class_stats_t &s = classes[rank[components->get_component(obj)]][name ? name : RubyHeapObj::get_value_type_string(obj->get_type())];
+    s.count++;
+    s.memsize += obj->get_memsize();
+  }
+
+  Output::with_handle([&](FILE *out) {
+    fprintf(out, "top %zu of %'zu reference cycles by memsize:\n", limit, num_components);
+    for (size_t i = 0; i < limit; ++i) {
+      const StronglyConnectedComponents::Component &c = components->get_component_info(ids[i]);
+      fprintf(out, "#%u: %'u objects, %'zu bytes\n", ids[i], c.size, c.memsize);
+
+      std::vector<std::pair<const char *, class_stats_t>> top(classes[i].begin(), classes[i].end());
+      size_t n = std::min<size_t>(5, top.size());
+      std::partial_sort(top.begin(), top.begin() + n, top.end(),
+          [] (const std::pair<const char *, class_stats_t> &a, const std::pair<const char *, class_stats_t> &b) {
+        return a.second.memsize > b.second.memsize;
+      });
+      for (size_t j = 0; j < n; ++j) {
+        fprintf(out, "%12s %'12zu %'16zu  %s\n", "", top[j].second.count, top[j].second.memsize, top[j].first);
+      }
+    }
+  });
+}
+
+static void
+cmd_allocsites(const char *args) {
+  struct site_stats_t {
+    size_t count, memsize, retained;
+  };
+
+  size_t limit = 20;
+  if (args && *args) {
+    limit = strtoul(args, NULL, 0);
+  }
+
+  size_t num_sites = graph_->get_alloc_site_count();
+  if (num_sites <= 1) {
+    printf("no allocation sites found (dump with ObjectSpace.trace_object_allocations enabled)\n");
+    return;
+  }
+
+  // Each thread aggregates its slice of the node table into its own table
+  // of sites, and the tables are summed afterwards.
+  size_t num_nodes = graph_->get_num_nodes();
+  std::vector<std::vector<site_stats_t>> thread_stats(parallel_num_threads(num_nodes),
+      std::vector<site_stats_t>(num_sites, site_stats_t()));
+
+  parallel_for(num_nodes, [&] (size_t begin, size_t end, size_t thread) {
+    std::vector<site_stats_t> &stats = thread_stats[thread];
+    for (size_t i = begin; i < end; ++i) {
+      RubyHeapObj *obj = graph_->get_node(i);
+      if (!obj || obj->is_root_object() || !obj->get_alloc_site()) {
+        continue;
+      }
+      site_stats_t &s = stats[obj->get_alloc_site()];
+      s.count++;
+      s.memsize += obj->get_memsize();
+    }
+  });
+
+  std::vector<site_stats_t> &totals = thread_stats[0];
+  for (size_t t = 1; t < thread_stats.size(); ++t) {
+    for (size_t i = 1; i < num_sites; ++i) {
+      totals[i].count += thread_stats[t][i].count;
+      totals[i].memsize += thread_stats[t][i].memsize;
+    }
+  }
+
+  // An object's retained size only counts towards its site when no object
+  // from the same site dominates it, or the memory would be counted twice.
+  // One walk down the dominator tree keeps how many objects from each site
+  // are on the path from the root; an entry with exit set undoes its object.
+  struct visit_t {
+    RubyHeapObj *obj;
+    bool exit;
+  };
+  std::vector<uint32_t> on_path(num_sites, 0);
+  std::vector<RubyHeapObj *> children;
+  std::vector<visit_t> stack;
+  if (graph_->has_dominator_tree()) {
+    stack.push_back({ graph_->get_root(), false });
+  }
+  while (!stack.empty() && !Cancellation::requested()) {
+    visit_t visit = stack.back();
+    stack.pop_back();
+    uint32_t site = visit.obj->is_root_object() ? 0 : visit.obj->get_alloc_site();
+    if (visit.exit) {
+      on_path[site]--;
+      continue;
+    }
+    if (site) {
+      if (on_path[site] == 0) {
+        totals[site].retained += graph_->get_retained_size(visit.obj);
+      }
+      on_path[site]++;
+      stack.push_back({ visit.obj, true });
+    }
+    children.clear();
+    graph_->get_dominators(visit.obj, children);
+    for (auto child : children) {
+      stack.push_back({ child, false });
+    }
+  }
+
+  if (Cancellation::requested()) {
+    return;
+  }
+
+  std::vector<uint32_t> sites;
+  for (uint32_t i = 1; i < num_sites; ++i) {
+    if (totals[i].count) {
+      sites.push_back(i);
+    }
+  }
+  limit = std::min(limit, sites.size());
+  std::partial_sort(sites.begin(), sites.begin() + limit, sites.end(), [&] (uint32_t a, uint32_t b) {
+    return totals[a].memsize > totals[b].memsize;
+  });
+
+  Output::with_handle([&](FILE *out) {
+    fprintf(out, "top %zu of %'zu allocation sites by memsize:\n", limit, sites.size());
+    fprintf(out, "%12s %16s %16s  %s\n", "count", "memsize", "retained", "site");
+    for (size_t i = 0; i < limit; ++i) {
+      const AllocSite &site = graph_->get_alloc_site(sites[i]);
+      site_stats_t &s = totals[sites[i]];
+      fprintf(out, "%'12zu %'16zu %'16zu  %s:%u", s.count, s.memsize, s.retained,
+          site.file ? site.file : "?", site.line);
+      if (site.method) {
+        fprintf(out, " (%s)", site.method);
+      }
+      fprintf(out, "\n");
+    }
+  });
+}
+
+static void
+cmd_generations(const char *) {
+  struct generation_stats_t {
+    size_t count, memsize, old;
+  };
+  typedef std::map<uint32_t, generation_stats_t> generation_map_t;
+
+  size_t num_nodes = graph_->get_num_nodes();
+  std::vector<generation_map_t> thread_stats(parallel_num_threads(num_nodes));
+
+  parallel_for(num_nodes, [&] (size_t begin, size_t end, size_t thread) {
+    generation_map_t &stats = thread_stats[thread];
+    for (size_t i = begin; i < end; ++i) {
+      RubyHeapObj *obj = graph_->get_node(i);
+      if (!obj || obj->is_root_object()) {
+        continue;
+      }
+      generation_stats_t &s = stats[obj->get_generation()];
+      s.count++;
+      s.memsize += obj->get_memsize();
+      s.old += obj->is_old() ? 1 : 0;
+    }
+  });
+
+  generation_map_t &totals = thread_stats[0];
+  for (size_t t = 1; t < thread_stats.size(); ++t) {
+    for (auto it : thread_stats[t]) {
+      generation_stats_t &s = totals[it.first];
+      s.count += it.second.count;
+      s.memsize += it.second.memsize;
+      s.old += it.second.old;
+    }
+  }
+
+  Output::with_handle([&](FILE *out) {
+    fprintf(out, "%12s %12s %16s %12s\n", "generation", "objects", "memsize", "old");
+    for (auto it : totals) {
+      if (it.first == RUBY_GENERATION_UNKNOWN) {
+        fprintf(out, "%12s", "unknown");
+      } else {
+        fprintf(out, "%12u", it.first);
+      }
+      fprintf(out, " %'12zu %'16zu %'12zu\n", it.second.count, it.second.memsize, it.second.old);
+    }
+  });
+}
+
+static uint64_t
+gcd(uint64_t a, uint64_t b) {
+  while (b) {
+    uint64_t t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+static void
+cmd_pages(const char *args) {
+  std::vector<std::string> argv;
+  split_args(args, argv);
+
+  size_t limit = 10;
+  // Ruby aligns its heap pages to 64KB (16KB before 2.7), and RVALUE slots
+  // are 40 bytes, or one of several sizes with variable width allocation
+  uint64_t page_size = 65536;
+  std::vector<uint64_t> slot_sizes;
+
+  for (size_t i = 0; i < argv.size(); ++i) {
+    if (argv[i] == "--page-size" && i + 1 < argv.size()) {
+      page_size = strtoull(argv[++i].c_str(), NULL, 0);
+    } else if (argv[i] == "--slot-sizes" && i + 1 < argv.size()) {
+      const char *p = argv[++i].c_str();
+      while (*p) {
+        char *end;
+        slot_sizes.push_back(strtoull(p, &end, 0));
+        p = *end == ',' ? end + 1 : end;
+        if (slot_sizes.back() == 0) {
+          break;
+        }
+      }
+    } else if (isdigit(argv[i][0])) {
+      limit = strtoul(argv[i].c_str(), NULL, 0);
+    } else {
+      printf("error: unknown option %s\n", argv[i].c_str());
+      return;
+    }
+  }
+  if (slot_sizes.empty()) {
+    slot_sizes.push_back(40);
+  }
+  std::sort(slot_sizes.begin(), slot_sizes.end());
+  if (page_size == 0 || (page_size & (page_size - 1)) != 0) {
+    printf("error: the page size must be a power of two\n");
+    return;
+  }
+  if (slot_sizes.front() == 0 || slot_sizes.back() > page_size) {
+    printf("error: slot sizes must be between 1 and the page size\n");
+    return;
+  }
+  if (graph_->is_sampled()) {
+    printf("error: page occupancy needs every object, so it isn't available for a sampled heap\n");
+    return;
+  }
+
+  typedef struct page {
+    uint64_t base, slot_size; // slot_size is 0 when it isn't known
+    size_t first, live;
+
+    size_t capacity(uint64_t page_size) const { return slot_size ? page_size / slot_size : 0; }
+    double occupancy(uint64_t page_size) const { return slot_size ? (double) live / capacity(page_size) : 0; }
+  } page_t;
+
+  // Objects on the same page share the address bits above the page size, so
+  // in address order each page is one run. A page only holds one slot size.
+  // Dumps from Ruby 3.2 on record each object's slot size; for older dumps
+  // it's the configured size that divides the distance between every pair
+  // of the page's objects. When several sizes do (or the page has a single
+  // object) and the dump doesn't say, the slot size is unknown.
+  const std::vector<uint64_t> &addrs = graph_->get_sorted_addresses();
+  uint64_t page_mask = ~(page_size - 1);
+  std::vector<page_t> pages;
+  for (size_t i = 0; i < addrs.size() && !Cancellation::requested(); ) {
+    page_t page = { addrs[i] & page_mask, 0, i, 0 };
+    uint64_t stride = 0;
+    uint32_t recorded = graph_->get_heap_object(addrs[i])->get_slot_size();
+    for (; i < addrs.size() && (addrs[i] & page_mask) == page.base; ++i) {
+      stride = gcd(stride, addrs[i] - addrs[page.first]);
+      if (graph_->get_heap_object(addrs[i])->get_slot_size() != recorded) {
+        recorded = 0;
+      }
+      page.live++;
+    }
+    if (recorded > 0 && recorded <= page_size && page.live <= page_size / recorded) {
+      page.slot_size = recorded;
+    } else {
+      size_t matches = 0;
+      for (auto slot_size : slot_sizes) {
+        if (stride % slot_size == 0 && page.live <= page_size / slot_size) {
+          page.slot_size = slot_size;
+          matches++;
+        }
+      }
+      if (matches > 1) {
+        page.slot_size = 0;
+      } else if (matches == 0) {
+        // Slot sizes that don't match the dump shouldn't show pages over
+        // 100% full
+        page.slot_size = slot_sizes.front();
+        page.live = std::min(page.live, page.capacity(page_size));
+      }
+    }
+    pages.push_back(page);
+  }
+
+  if (Cancellation::requested()) {
+    return;
+  }
+
+  static const int kBuckets = 10;
+  size_t histogram[kBuckets] = { 0 };
+  size_t live = 0, capacity = 0, pinned = 0, unknown = 0;
+  for (auto &page : pages) {
+    pinned += page.live == 1 ? 1 : 0;
+    if (page.slot_size == 0) {
+      unknown++;
+      continue;
+    }
+    live += page.live;
+    capacity += page.capacity(page_size);
+    histogram[std::min<int>(page.occupancy(page_size) * kBuckets, kBuckets - 1)]++;
+  }
+
+  // Pages of an unknown slot size go last, fewest live objects first
+  auto emptier = [&] (const page_t &a, const page_t &b) {
+    if ((a.slot_size == 0) != (b.slot_size == 0)) {
+      return b.slot_size == 0;
+    } else if (a.slot_size == 0) {
+      return a.live < b.live || (a.live == b.live && a.base < b.base);
+    }
+    double a_occupancy = a.occupancy(page_size), b_occupancy = b.occupancy(page_size);
+    return a_occupancy < b_occupancy || (a_occupancy == b_occupancy && a.base < b.base);
+  };
+  size_t num_emptiest = std::min(limit, pages.size());
+  std::partial_sort(pages.begin(), pages.begin() + num_emptiest, pages.end(), emptier);
+
+  Output::with_handle([&](FILE *out) {
+    if (pages.empty()) {
+      fprintf(out, "no heap objects\n");
+      return;
+    }
+    fprintf(out, "%'zu pages of %'" PRIu64 " bytes (%'" PRIu64 " bytes), %'zu of %'zu slots live (%.1f%%)\n",
+      pages.size(), page_size, pages.size() * page_size, live, capacity, capacity ? 100.0 * live / capacity : 0.0);
+    if (unknown > 0) {
+      fprintf(out, "%'zu pages of an unknown slot size aren't counted in the occupancy\n", unknown);
+    }
+    fprintf(out, "%'zu pages (%'" PRIu64 " bytes) pinned by a single object\n\n", pinned, pinned * page_size);
+
+    fprintf(out, "%10s %12s\n", "occupancy", "pages");
+    for (int i = 0; i < kBuckets; ++i) {
+      fprintf(out, "%5d-%3d%% %'12zu\n", i * 100 / kBuckets, (i + 1) * 100 / kBuckets, histogram[i]);
+    }
+
+    fprintf(out, "\nemptiest pages:\n");
+    for (size_t i = 0; i < num_emptiest && !Cancellation::requested(); ++i) {
+      const page_t &page = pages[i];
+      if (page.slot_size == 0) {
+        fprintf(out, "0x%" PRIx64 ": %'zu live, slot size unknown\n", page.base, page.live);
+      } else {
+        fprintf(out, "0x%" PRIx64 ": %'zu of %'zu %" PRIu64 " byte slots live\n", page.base, page.live,
+          page.capacity(page_size), page.slot_size);
+      }
+      // Only the objects on a nearly empty page are worth listing
+      for (size_t j = page.first; j < page.first + std::min<size_t>(page.live, 5); ++j) {
+        graph_->get_heap_object(addrs[j])->print_ref_object(out);
+      }
+      if (page.live > 5) {
+        fprintf(out, "%20s  ... %'zu more\n", "", page.live - 5);
+      }
+    }
+  });
+}
+
+// Keeps the limit largest values seen in top, as a min-heap ordered by larger
+template<typename T, typename Compare> static void
+add_top(std::vector<T> &top, const T &value, size_t limit, Compare larger) {
+  if (top.size() < limit) {
+    top.push_back(value);
+    std::push_heap(top.begin(), top.end(), larger);
+  } else if (limit > 0 && larger(value, top.front())) {
+    std::pop_heap(top.begin(), top.end(), larger);
+    top.back() = value;
+    std::push_heap(top.begin(), top.end(), larger);
+  }
+}
+
+static void
+cmd_top(const char *args) {
+  std::vector<std::string> argv;
+  split_args(args, argv);
+
+  size_t limit = 20;
+  // Retained sizes need the dominator tree
+  bool by_memsize = !graph_->has_dominator_tree();
+  bool older_than = false;
+  uint32_t generation = 0;
+
+  for (size_t i = 0; i < argv.size(); ++i) {
+    if (argv[i] == "--older-than" && i + 1 < argv.size()) {
+      older_than = true;
+      generation = strtoul(argv[++i].c_str(), NULL, 0);
+    } else if (argv[i] == "--by" && i + 1 < argv.size()) {
+      by_memsize = argv[++i] == "memsize";
+    } else if (isdigit(argv[i][0])) {
+      limit = strtoul(argv[i].c_str(), NULL, 0);
+    } else {
+      printf("error: unknown option %s\n", argv[i].c_str());
+      return;
+    }
+  }
+
+  auto size_of = [&] (RubyHeapObj *obj) {
+    return by_memsize ? obj->get_memsize() : graph_->get_retained_size(obj);
+  };
+  auto larger = [&] (RubyHeapObj *a, RubyHeapObj *b) {
+    return size_of(a) > size_of(b);
+  };
+
+  // Each thread keeps a min-heap of its largest matches; the heaps are
+  // merged once all threads are done.
+  size_t num_nodes = graph_->get_num_nodes();
+  std::vector<std::vector<RubyHeapObj *>> thread_top(parallel_num_threads(num_nodes));
+
+  parallel_for(num_nodes, [&] (size_t begin, size_t end, size_t thread) {
+    std::vector<RubyHeapObj *> &top = thread_top[thread];
+    for (size_t i = begin; i < end; ++i) {
+      RubyHeapObj *obj = graph_->get_node(i);
+      if (!obj || obj->is_root_object()) {
+        continue;
+      }
+      if (older_than && (!obj->has_generation() || obj->get_generation() >= generation)) {
+        continue;
+      }
+      add_top(top, obj, limit, larger);
+    }
+  });
+
+  std::vector<RubyHeapObj *> top;
+  for (auto &t : thread_top) {
+    top.insert(top.end(), t.begin(), t.end());
+  }
+  std::sort(top.begin(), top.end(), larger);
+  if (top.size() > limit) {
+    top.resize(limit);
+  }
+
+  Output::with_handle([&](FILE *out) {
+    fprintf(out, "%16s %12s %10s  %s\n", "retained", "memsize", "generation", "object");
+    for (auto obj : top) {
+      char buf[64];
+      fprintf(out, "%'16zu %'12zu ", graph_->get_retained_size(obj), obj->get_memsize());
+      if (obj->has_generation()) {
+        fprintf(out, "%10u", obj->get_generation());
+      } else {
+        fprintf(out, "%10s", "-");
+      }
+      fprintf(out, "  0x%" PRIx64 " (%s)\n", obj->get_addr(), obj->get_object_summary(buf, sizeof(buf)));
+    }
+  });
+}
+
+static void
+cmd_quit(const char *) {
+  exit_ = true;
+}
+
+static void
+cmd_help(const char *) {
+  printf("You can run the following commands:\n\n");
+  for (int i = 0; commands_[i].name != NULL; ++i) {
+    printf("\t%10s - %s\n", commands_[i].name, commands_[i].help);
+  }
+  printf("\n");
+}
+
+static void
+cmd_diff(const char *args) {
+  if (args == NULL || strlen(args) == 0) {
+    printf("error: you must specify a heap dump file\n");
+    return;
+  }
+
+  InputStream *in = InputStream::open(args);
+  if (!in) {
+    printf("unable to open %s: %d\n", args, errno);
+    return;
+  }
+
+  char template_name[] = "harb_diff-XXXXXX";
+  int fd = mkstemp(template_name);
+  if (fd == -1) {
+    printf("unable to create tempfile: %d\n", errno);
+    delete in;
+    return;
+  }
+
+  FILE *out = fdopen(fd, "w");
+  if (!out) {
+    printf("unable to open temp fd: %d", errno);
+    delete in;
+    return;
+  }
+
+  Parser p(in);
+  p.set_capture_json(true);
+  p.parse([&] (RubyHeapObj *obj) {
+    if (!obj->is_root_object() && graph_->get_heap_object(obj->get_addr()) == NULL) {
+      const char *s = p.current_heap_object_json();
+      fprintf(out, "%s\n", s);
+    }
+  });
+
+  fclose(out);
+  delete in;
+}
+
+static void
+use_graph(const std::string &name) {
+  loaded_graph_t &loaded = graphs_[name];
+  graph_name_ = name;
+  graph_ = loaded.graph;
+  completer_ = loaded.completer;
+}
+
+static void
+cmd_load(const char *args) {
+  std::vector<std::string> argv;
+  split_args(args, argv);
+  if (argv.size() != 2) {
+    printf("usage: load <name> <file>\n");
+    return;
+  }
+  const std::string &name = argv[0];
+  if (name.find(':') != std::string::npos) {
+    printf("error: %s can't be used as a name\n", name.c_str());
+    return;
+  }
+  if (graphs_.count(name)) {
+    printf("error: a dump is already loaded as %s\n", name.c_str());
+    return;
+  }
+
+  const char *filename = argv[1].c_str();
+  InputStream *in = InputStream::open(filename);
+  if (!in) {
+    printf("error: unable to open %s: %d\n", filename, errno);
+    return;
+  }
+
+  size_t num_strings = strings_->size();
+  Graph *graph = new Graph(in, 1, strings_, value_bytes_);
+  int error = in->get_error();
+  delete in;
+  if (error) {
+    printf("error: error reading %s: %d\n", filename, error);
+    delete graph;
+    return;
+  }
+
+  loaded_graph_t &loaded = graphs_[name];
+  loaded.graph = graph;
+  loaded.completer = new Completer(graph);
+  loaded.filename = filename;
+  printf("loaded %s as %s: %'zu objects, %'zu new strings\n", filename, name.c_str(),
+    graph->get_num_heap_objects(), strings_->size() - num_strings);
+}
+
+static void
+cmd_use(const char *args) {
+  std::vector<std::string> argv;
+  split_args(args, argv);
+  if (argv.size() != 1) {
+    printf("usage: use <name>\n");
+    return;
+  }
+  if (!graphs_.count(argv[0])) {
+    printf("error: no dump loaded as %s\n", argv[0].c_str());
+    return;
+  }
+  use_graph(argv[0]);
+}
+
+static void
+cmd_graphs(const char *) {
+  for (auto &it : graphs_) {
+    printf("%s %-8s %'12zu objects  %s\n", it.first == graph_name_ ? "*" : " ", it.first.c_str(),
+      it.second.graph->get_num_heap_objects(), it.second.filename.c_str());
+  }
+  printf("%'zu interned strings (%'zu bytes) shared by all dumps\n", strings_->size(), strings_->get_bytes());
+}
+
+static void
+cmd_cache(const char *args) {
+  std::vector<std::string> argv;
+  split_args(args, argv);
+  if (argv.empty() || argv[0] == "stats") {
+    size_t lookups = cache_->get_hits() + cache_->get_misses();
+    printf("%'zu entries, %'zu of %'zu bytes\n", cache_->get_num_entries(), cache_->get_bytes(),
+        cache_->get_max_bytes());
+    printf("%'zu hits, %'zu misses (%.1f%% hit rate), %'zu evictions\n", cache_->get_hits(),
+        cache_->get_misses(), lookups ? 100.0 * cache_->get_hits() / lookups : 0.0, cache_->get_evictions());
+  } else if (argv[0] == "clear") {
+    cache_->clear();
+  } else if (argv[0] == "size" && argv.size() == 2) {
+    char *end;
+    size_t mb = strtoul(argv[1].c_str(), &end, 10);
+    if (*end || argv[1].empty()) {
+      printf("error: invalid size: %s\n", argv[1].c_str());
+      return;
+    }
+    cache_->set_max_bytes(mb << 20);
+  } else {
+    printf("usage: cache [stats | clear | size <MB>]\n");
+  }
+}
+
+// Objects in two dumps are taken to be the same object if they're at the
+// same address and have the same type and class. Both dumps intern into
+// strings_, so equal class names are the same pointer.
+static bool
+is_same_object(RubyHeapObj *a, RubyHeapObj *b) {
+  if (a->get_type() != b->get_type()) {
+    return false;
+  }
+  RubyHeapObj *a_class = a->get_class_obj(), *b_class = b->get_class_obj();
+  if (!a_class || !b_class) {
+    return !a_class && !b_class;
+  }
+  return a_class->get_value() == b_class->get_value();
+}
+
+static void
+cmd_compare(const char *args) {
+  std::vector<std::string> argv;
+  split_args(args, argv);
+  if (argv.empty() || argv.size() > 2) {
+    printf("usage: compare <name> [n]\n");
+    return;
+  }
+  auto it = graphs_.find(argv[0]);
+  if (it == graphs_.end()) {
+    printf("error: no dump loaded as %s\n", argv[0].c_str());
+    return;
+  }
+  Graph *other = it->second.graph;
+  if (other == graph_) {
+    printf("error: %s is the current dump\n", argv[0].c_str());
+    return;
+  }
+  size_t limit = argv.size() > 1 ? strtoul(argv[1].c_str(), NULL, 0) : 20;
+
+  // Retained sizes need the dominator tree in both dumps
+  bool by_memsize = !graph_->has_dominator_tree() || !other->has_dominator_tree();
+  auto size_of = [&] (RubyHeapObj *obj) {
+    return by_memsize ? obj->get_memsize() : obj->get_graph()->get_retained_size(obj);
+  };
+
+  typedef struct match {
+    RubyHeapObj *a, *b;
+    int64_t delta;
+  } match_t;
+  auto larger = [] (const match_t &x, const match_t &y) {
+    return llabs(x.delta) > llabs(y.delta);
+  };
+
+  typedef struct compare_stats {
+    size_t matched, only_count, only_memsize;
+    std::vector<match_t> top;
+
+    compare_stats() : matched(0), only_count(0), only_memsize(0) {}
+  } compare_stats_t;
+
+  // The current dump's objects are looked up in the other one; each thread
+  // keeps a min-heap of its largest changes, merged once all are done
+  size_t num_nodes = graph_->get_num_nodes();
+  std::vector<compare_stats_t> thread_stats(parallel_num_threads(num_nodes));
+  parallel_for(num_nodes, [&] (size_t begin, size_t end, size_t thread) {
+    compare_stats_t &stats = thread_stats[thread];
+    for (size_t i = begin; i < end && !Cancellation::requested(); ++i) {
+      RubyHeapObj *obj = graph_->get_node(i);
+      if (!obj || obj->is_root_object()) {
+        continue;
+      }
+      RubyHeapObj *match = other->get_heap_object(obj->get_addr());
+      if (!match || !is_same_object(obj, match)) {
+        stats.only_count++;
+        stats.only_memsize += obj->get_memsize();
+        continue;
+      }
+      stats.matched++;
+      match_t m = { obj, match, (int64_t) size_of(match) - (int64_t) size_of(obj) };
+      if (m.delta == 0) {
+        continue;
+      }
+      add_top(stats.top, m, limit, larger);
+    }
+  });
+
+  // Then whatever in the other dump had no match
+  size_t other_nodes = other->get_num_nodes();
+  std::vector<compare_stats_t> other_stats(parallel_num_threads(other_nodes));
+  parallel_for(other_nodes, [&] (size_t begin, size_t end, size_t thread) {
+    compare_stats_t &stats = other_stats[thread];
+    for (size_t i = begin; i < end && !Cancellation::requested(); ++i) {
+      RubyHeapObj *obj = other->get_node(i);
+      if (!obj || obj->is_root_object()) {
+        continue;
+      }
+      RubyHeapObj *match = graph_->get_heap_object(obj->get_addr());
+      if (!match || !is_same_object(match, obj)) {
+        stats.only_count++;
+        stats.only_memsize += obj->get_memsize();
+      }
+    }
+  });
+
+  if (Cancellation::requested()) {
+    return;
+  }
+
+  compare_stats_t total, other_total;
+  for (auto &stats : thread_stats) {
+    total.matched += stats.matched;
+    total.only_count += stats.only_count;
+    total.only_memsize += stats.only_memsize;
+    total.top.insert(total.top.end(), stats.top.begin(), stats.top.end());
+  }
+  for (auto &stats : other_stats) {
+    other_total.only_count += stats.only_count;
+    other_total.only_memsize += stats.only_memsize;
+  }
+  std::sort(total.top.begin(), total.top.end(), larger);
+  if (total.top.size() > limit) {
+    total.top.resize(limit);
+  }
+
+  const char *name = argv[0].c_str();
+  Output::with_handle([&](FILE *out) {
+    fprintf(out, "%'zu objects in both %s and %s\n", total.matched, graph_name_.c_str(), name);
+    fprintf(out, "%'zu objects (%'zu bytes) only in %s\n", total.only_count, total.only_memsize, graph_name_.c_str());
+    fprintf(out, "%'zu objects (%'zu bytes) only in %s\n", other_total.only_count, other_total.only_memsize, name);
+    if (total.top.empty()) {
+      return;
+    }
+    const char *what = by_memsize ? "memsize" : "retained";
+    fprintf(out, "\nlargest changes in %s size:\n", what);
+    fprintf(out, "%16s %16s %16s  %s\n", graph_name_.c_str(), name, "change", "object");
+    for (auto &m : total.top) {
+      char buf[64];
+      fprintf(out, "%'16zu %'16zu %+'16" PRId64 "  0x%" PRIx64 " (%s)\n", size_of(m.a), size_of(m.b), m.delta,
+        m.a->get_addr(), m.a->get_object_summary(buf, sizeof(buf)));
+    }
+  });
+}
+
+static RubyHeapObj *
+get_ruby_heap_obj_arg(const char *args) {
+  if (args == NULL || strlen(args) == 0) {
+    printf("error: you must specify an address\n");
+    return NULL;
+  }
+
+  // Objects in other loaded dumps are addressed as name:0x...
+  Graph *graph = graph_;
+  const char *colon = strchr(args, ':');
+  if (colon) {
+    auto it = graphs_.find(std::string(args, colon - args));
+    if (it == graphs_.end()) {
+      printf("error: no dump loaded as %.*s\n", (int) (colon - args), args);
+      return NULL;
+    }
+    graph = it->second.graph;
+    args = colon + 1;
+  }
+
+  uint64_t addr = strtoull(args, NULL, 0);
+  if (addr == 0) {
+    printf("error: you must specify a valid heap address\n");
+    return NULL;
+  }
+
+  RubyHeapObj *obj = graph->get_heap_object(addr);
+  if (!obj) {
+    printf("error: no ruby object found at address 0x%" PRIx64 "\n", addr);
+    return NULL;
+  }
+
+  return obj;
+}
+
+static void
+cmd_print(const char *args) {
+  RubyHeapObj *obj = get_ruby_heap_obj_arg(args);
+  if (!obj) {
+    return;
+  }
+  Graph *graph = obj->get_graph();
+
+  // print shows the object's reference cycle, so find those up front
+  graph->get_components();
+
+  Output::with_handle([&](FILE *out) {
+    obj->print_object(out);
+  });
+}
+
+static void
+cmd_idom(const char *args) {
+  RubyHeapObj *obj = get_ruby_heap_obj_arg(args);
+  if (!obj || obj->is_root_object()) {
+    return;
+  }
+  Graph *graph = obj->get_graph();
+
+  if (!graph->has_dominator_tree()) {
+    printf("error: dominators are not available for a sampled heap\n");
+    return;
+  }
+
+  RubyHeapObj *idom = graph->get_idom(obj);
+
+  Output::with_handle([&](FILE *out) {
+    if (idom) {
+      fprintf(out, "dominator for 0x%" PRIx64 ":\n", obj->get_addr());
+      idom->print_ref_object(out);
+    } else {
+      fprintf(out, "could not determine dominator for 0x%" PRIx64 ": ", obj->get_addr());
+    }
+  });
+}
+
+static void
+cmd_dominators(const char * args) {
+  RubyHeapObj *obj = get_ruby_heap_obj_arg(args);
+  if (!obj || obj->is_root_object()) {
+    return;
+  }
+  Graph *graph = obj->get_graph();
+
+  if (!graph->has_dominator_tree()) {
+    printf("error: dominators are not available for a sampled heap\n");
+    return;
+  }
+
+  Output::with_handle([&](FILE *out) {
+    fprintf(out, "0x%" PRIx64 " dominates:\n", obj->get_addr());
+
+    std::vector<RubyHeapObj *> dominators;
+    graph->get_dominators(obj, dominators);
+
+    if (!dominators.empty()) {
+      for (auto child : dominators) {
+        if (Cancellation::requested()) {
+          break;
+        }
+        child->print_ref_object(out);
+      }
+    } else {
+      fprintf(out, "0x%" PRIx64 " does not dominate any objects\n", obj->get_addr());
+    }
+  });
+}
+
+// Where `tree` left off, so it can be browsed by child index
+static RubyHeapObj *tree_cursor_ = NULL;
+
+static void
+print_tree_node(FILE *out, RubyHeapObj *obj, size_t retained, int indent, const std::string &label) {
+  char buf[64];
+  fprintf(out, "%'16zu  %*s", retained, indent, "");
+  if (!label.empty()) {
+    fprintf(out, "[%s] ", label.c_str());
+  }
+  if (obj == obj->get_graph()->get_root()) {
+    fprintf(out, "(all roots)\n");
+  } else if (obj->is_root_object()) {
+    fprintf(out, "ROOT (%s)\n", obj->get_root_name());
+  } else {
+    fprintf(out, "0x%" PRIx64 " (%s)\n", obj->get_addr(), obj->get_object_summary(buf, sizeof(buf)));
+  }
+}
+
+// Prints the first limit children of obj, and theirs down to depth levels.
+// Children are stored largest first, so nothing is sorted here.
+static void
+print_tree_children(FILE *out, RubyHeapObj *obj, const std::string &label, size_t depth, size_t limit, int indent) {
+  Graph *graph = obj->get_graph();
+  size_t num_children = graph->get_num_dominated(obj);
+  size_t shown = std::min(limit, num_children);
+  size_t shown_bytes = 0;
+  for (size_t i = 0; i < shown && !Cancellation::requested(); ++i) {
+    RubyHeapObj *child = graph->get_dominated(obj, i);
+    std::string child_label = (label.empty() ? "" : label + ".") + std::to_string(i + 1);
+    size_t retained = graph->get_retained_size(child);
+    shown_bytes += retained;
+    print_tree_node(out, child, retained, indent, child_label);
+    if (depth > 1) {
+      print_tree_children(out, child, child_label, depth - 1, limit, indent + 2);
+    }
+  }
+  if (shown < num_children) {
+    // An object retains itself plus everything its children retain
+    size_t children_bytes = graph->get_retained_size(obj) - (obj->is_root_object() ? 0 : obj->get_memsize());
+    fprintf(out, "%'16zu  %*s... and %'zu more\n", children_bytes - shown_bytes, indent, "", num_children - shown);
+  }
+}
+
+static void
+cmd_tree(const char *args) {
+  std::vector<std::string> argv;
+  split_args(args, argv);
+
+  RubyHeapObj *obj = tree_cursor_ && tree_cursor_->get_graph() == graph_ ? tree_cursor_ : graph_->get_root();
+  size_t depth = 1, limit = 10;
+
+  if (!argv.empty()) {
+    const std::string &where = argv[0];
+    if (where == "/") {
+      obj = obj->get_graph()->get_root();
+    } else if (where == "..") {
+      RubyHeapObj *idom = obj->get_graph()->get_idom(obj);
+      obj = idom ? idom : obj;
+    } else if (where == ".") {
+      // stay here
+    } else if (where.find_first_not_of("0123456789.") == std::string::npos) {
+      // A child index as printed by the last tree, like 2 or 2.1.3
+      const char *p = where.c_str();
+      while (*p) {
+        char *end;
+        size_t i = strtoul(p, &end, 10);
+        if (end == p || i == 0 || i > obj->get_graph()->get_num_dominated(obj)) {
+          printf("error: no child %s\n", where.c_str());
+          return;
+        }
+        obj = obj->get_graph()->get_dominated(obj, i - 1);
+        p = *end == '.' ? end + 1 : end;
+      }
+    } else {
+      obj = get_ruby_heap_obj_arg(where.c_str());
+      if (!obj) {
+        return;
+      }
+    }
+  }
+  if (argv.size() > 1) {
+    depth = strtoul(argv[1].c_str(), NULL, 0);
+  }
+  if (argv.size() > 2) {
+    limit = strtoul(argv[2].c_str(), NULL, 0);
+  }
+
+  if (!obj->get_graph()->has_dominator_tree()) {
+    printf("error: the dominator tree isn't built for a sampled heap\n");
+    return;
+  }
+  tree_cursor_ = obj;
+
+  Output::with_handle([&](FILE *out) {
+    print_tree_node(out, obj, obj->get_graph()->get_retained_size(obj), 0, "");
+    if (depth > 0) {
+      print_tree_children(out, obj, "", depth, limit, 2);
+    }
+  });
+}
+
+static void
+cmd_roots(const char *args) {
+  size_t limit = args && isdigit(args[0]) ? strtoul(args, NULL, 0) : 5;
+
+  if (!graph_->has_dominator_tree()) {
+    printf("error: retained sizes are not available for a sampled heap\n");
+    return;
+  }
+
+  typedef struct category {
+    const char *name;
+    size_t count, retained;
+    std::vector<RubyHeapObj *> top;
+
+    category(const char *name) : name(name), count(0), retained(0) {}
+  } category_t;
+
+  // Whatever is dominated by a ROOT record is only reachable through that
+  // root category. The synthetic root dominates directly whatever several
+  // categories keep alive.
+  std::vector<category_t> categories(1, category_t("(multiple roots)"));
+  std::map<const char *, size_t> category_ids;
+  auto retained_more = [&] (RubyHeapObj *a, RubyHeapObj *b) {
+    return graph_->get_retained_size(a) > graph_->get_retained_size(b);
+  };
+
+  // One walk down the dominator tree, each object inheriting the category
+  // of its idom
+  std::vector<std::pair<RubyHeapObj *, size_t>> stack;
+  std::vector<RubyHeapObj *> children;
+  graph_->get_dominators(graph_->get_root(), children);
+  for (auto child : children) {
+    size_t id = 0;
+    if (child->is_root_object()) {
+      auto it = category_ids.find(child->get_root_name());
+      if (it == category_ids.end()) {
+        it = category_ids.insert(std::make_pair(child->get_root_name(), categories.size())).first;
+        categories.push_back(category_t(child->get_root_name()));
+      }
+      id = it->second;
+    }
+    categories[id].retained += graph_->get_retained_size(child);
+    stack.push_back(std::make_pair(child, id));
+  }
+
+  while (!stack.empty() && !Cancellation::requested()) {
+    RubyHeapObj *obj = stack.back().first;
+    size_t id = stack.back().second;
+    category_t &c = categories[id];
+    stack.pop_back();
+
+    // The objects each ROOT record (or the synthetic root) dominates
+    // directly don't overlap, so they're the ones worth listing
+    RubyHeapObj *idom = graph_->get_idom(obj);
+    if (!obj->is_root_object()) {
+      c.count++;
+      if (idom && idom->is_root_object()) {
+        add_top(c.top, obj, limit, retained_more);
+      }
+    }
+
+    children.clear();
+    graph_->get_dominators(obj, children);
+    for (auto child : children) {
+      stack.push_back(std::make_pair(child, id));
+    }
+  }
+
+  if (Cancellation::requested()) {
+    return;
+  }
+
+  size_t reachable = 0;
+  for (auto &c : categories) {
+    reachable += c.count;
+    std::sort(c.top.begin(), c.top.end(), retained_more);
+  }
+  std::sort(categories.begin(), categories.end(), [] (const category_t &a, const category_t &b) {
+    return a.retained > b.retained;
+  });
+  size_t total = graph_->get_retained_size(graph_->get_root());
+
+  Output::with_handle([&](FILE *out) {
+    fprintf(out, "%-20s %12s %16s %7s\n", "root", "objects", "retained", "");
+    for (auto &c : categories) {
+      if (c.count == 0) {
+        continue;
+      }
+      fprintf(out, "%-20s %'12zu %'16zu %6.2f%%\n", c.name, c.count, c.retained,
+        total ? 100.0 * c.retained / total : 0);
+    }
+    size_t unreachable = graph_->get_num_heap_objects() - reachable;
+    if (unreachable) {
+      fprintf(out, "%-20s %'12zu\n", "(unreachable)", unreachable);
+    }
+
+    for (auto &c : categories) {
+      if (c.top.empty() || Cancellation::requested()) {
+        continue;
+      }
+      fprintf(out, "\n%s:\n", c.name);
+      for (auto obj : c.top) {
+        char buf[64];
+        fprintf(out, "%'16zu  0x%" PRIx64 " (%s)\n", graph_->get_retained_size(obj), obj->get_addr(),
+          obj->get_object_summary(buf, sizeof(buf)));
+      }
+    }
+  });
+}
+
+static void
+cmd_rootpath(const char *args) {
+  RubyHeapObj *obj = get_ruby_heap_obj_arg(args);
+  if (!obj) {
+    return;
+  }
+
+  typedef ResultCache::Value<RubyHeapObjList> cached_path_t;
+  std::shared_ptr<cached_path_t> cached = cache_->get<cached_path_t>("rootpath", obj);
+  if (!cached) {
+    cached = std::make_shared<cached_path_t>();
+    obj->get_graph()->get_root_path(obj, cached->value);
+    if (Cancellation::requested()) {
+      return;
+    }
+    cached->bytes += cached->value.size() * sizeof(RubyHeapObj *);
+    cache_->put("rootpath", obj, "", cached);
+  }
+  const RubyHeapObjList &path = cached->value;
+  bool found = !path.empty();
+
+  Output::with_handle([&](FILE *out) {
+    if (!found) {
+      fprintf(out, "error: could not find path to root for 0x%" PRIx64 "\n", obj->get_addr());
+      return;
+    }
+
+    fprintf(out, "root path to 0x%" PRIx64 ":\n", obj->get_addr());
+    for (auto cur : path) {
+      cur->print_ref_object(out);
+    }
+    fprintf(out, "\n");
+  });
+}
+
+// Search state for cmd_path, indexed by node index: [0] is the forward
+// search from the source, [1] the backward search from the target. An entry
+// is only valid when its stamp matches the current search, so the arrays
+// never need clearing between searches.
+static struct {
+  uint32_t epoch;
+  std::vector<uint32_t> stamp[2];
+  std::vector<uint32_t> parent[2];
+  std::vector<uint32_t> dist[2];
+} path_search_;
+
+// Finds a shortest path from -> to with a bidirectional BFS, as node
+// indexes. Returns false if there is none (or the search was cancelled).
+static bool
+find_path(Graph *graph, RubyHeapObj *from, RubyHeapObj *to, std::vector<uint32_t> &path) {
+  size_t num_nodes = graph->get_num_nodes();
+  if (path_search_.stamp[0].size() != num_nodes || ++path_search_.epoch == 0) {
+    for (int side = 0; side < 2; ++side) {
+      path_search_.stamp[side].assign(num_nodes, 0);
+      path_search_.parent[side].resize(num_nodes);
+      path_search_.dist[side].resize(num_nodes);
+    }
+    path_search_.epoch = 1;
+  }
+  uint32_t epoch = path_search_.epoch;
+
+  std::vector<uint32_t> frontier[2], next;
+  frontier[0].push_back(from->get_index());
+  frontier[1].push_back(to->get_index());
+  for (int side = 0; side < 2; ++side) {
+    uint32_t idx = frontier[side][0];
+    path_search_.stamp[side][idx] = epoch;
+    path_search_.parent[side][idx] = 0;
+    path_search_.dist[side][idx] = 0;
+  }
+
+  // Expand whichever side has the smaller frontier a whole level at a time,
+  // and stop after the first level where the searches meet. Finishing the
+  // level makes sure the meeting point on the shortest path is picked.
+  uint32_t meet = 0, best = UINT32_MAX;
+  if (from == to) {
+    meet = from->get_index();
+  }
+  while (!meet && !frontier[0].empty() && !frontier[1].empty() && !Cancellation::requested()) {
+    int side = frontier[0].size() <= frontier[1].size() ? 0 : 1;
+    std::vector<uint32_t> &stamp = path_search_.stamp[side];
+    std::vector<uint32_t> &other = path_search_.stamp[!side];
+    next.clear();
+
+    auto visit = [&] (uint32_t u, RubyHeapObj *ref) {
+      uint32_t w = ref->get_index();
+      if (stamp[w] == epoch) {
+        return;
+      }
+      stamp[w] = epoch;
+      path_search_.parent[side][w] = u;
+      path_search_.dist[side][w] = path_search_.dist[side][u] + 1;
+      if (other[w] == epoch) {
+        uint32_t len = path_search_.dist[side][w] + path_search_.dist[!side][w];
+        if (len < best) {
+          best = len;
+          meet = w;
+        }
+      }
+      next.push_back(w);
+    };
+
+    for (auto u : frontier[side]) {
+      RubyHeapObj *obj = graph->get_node(u);
+      if (side == 0) {
+        if (obj->has_refs_to()) {
+          for (uint32_t i = 0; obj->get_refs_to(i); ++i) {
+            visit(u, obj->get_refs_to(i));
+          }
+        }
+      } else {
+        for (auto ref : *obj->get_refs_from()) {
+          visit(u, ref);
+        }
+      }
+    }
+    frontier[side].swap(next);
+  }
+
+  if (!meet || Cancellation::requested()) {
+    return false;
+  }
+
+  for (uint32_t idx = meet; idx; idx = path_search_.parent[0][idx]) {
+    path.push_back(idx);
+  }
+  std::reverse(path.begin(), path.end());
+  for (uint32_t idx = path_search_.parent[1][meet]; idx; idx = path_search_.parent[1][idx]) {
+    path.push_back(idx);
+  }
+  return true;
+}
+
+static void
+cmd_path(const char *args) {
+  std::vector<std::string> argv;
+  split_args(args, argv);
+  if (argv.size() != 2) {
+    printf("error: you must specify a source and a target address\n");
+    return;
+  }
+
+  RubyHeapObj *from = get_ruby_heap_obj_arg(argv[0].c_str());
+  RubyHeapObj *to = from ? get_ruby_heap_obj_arg(argv[1].c_str()) : NULL;
+  if (!from || !to) {
+    return;
+  }
+  if (from->get_graph() != to->get_graph()) {
+    printf("error: both objects must be in the same graph\n");
+    return;
+  }
+  Graph *graph = from->get_graph();
+
+  typedef ResultCache::Value<std::vector<uint32_t>> cached_path_t;
+  std::string options = std::to_string(to->get_index());
+  std::shared_ptr<cached_path_t> cached = cache_->get<cached_path_t>("path", from, options);
+  if (!cached) {
+    cached = std::make_shared<cached_path_t>();
+    find_path(graph, from, to, cached->value);
+    if (Cancellation::requested()) {
+      return;
+    }
+    cached->bytes += cached->value.size() * sizeof(uint32_t);
+    cache_->put("path", from, options, cached);
+  }
+  const std::vector<uint32_t> &path = cached->value;
+
+  Output::with_handle([&](FILE *out) {
+    if (path.empty()) {
+      fprintf(out, "no path from 0x%" PRIx64 " to 0x%" PRIx64 "\n", from->get_addr(), to->get_addr());
+      return;
+    }
+
+    fprintf(out, "path from 0x%" PRIx64 " to 0x%" PRIx64 " (%zu references):\n",
+        from->get_addr(), to->get_addr(), path.size() - 1);
+    for (auto idx : path) {
+      graph->get_node(idx)->print_ref_object(out);
+    }
+  });
+}
+
+static void
+cmd_reachable(const char *args) {
+  struct type_stats_t {
+    size_t count, memsize;
+  };
+  struct reachable_t {
+    size_t count;
+    std::vector<type_stats_t> totals;
+  };
+  typedef ResultCache::Value<reachable_t> cached_reachable_t;
+
+  RubyHeapObj *obj = get_ruby_heap_obj_arg(args);
+  if (!obj) {
+    return;
+  }
+  Graph *graph = obj->get_graph();
+
+  std::shared_ptr<cached_reachable_t> cached = cache_->get<cached_reachable_t>("reachable", obj);
+  if (!cached) {
+    ReachableSet reachable(graph);
+    reachable.calculate(obj);
+    if (Cancellation::requested()) {
+      return;
+    }
+
+    size_t num_nodes = graph->get_num_nodes();
+    std::vector<std::vector<type_stats_t>> thread_stats(parallel_num_threads(num_nodes),
+        std::vector<type_stats_t>(RUBY_T_MASK + 1, type_stats_t()));
+
+    parallel_for(num_nodes, [&] (size_t begin, size_t end, size_t thread) {
+      std::vector<type_stats_t> &stats = thread_stats[thread];
+      for (size_t i = begin; i < end; ++i) {
+        RubyHeapObj *node = graph->get_node(i);
+        if (!node || !reachable.contains(node)) {
+          continue;
+        }
+        type_stats_t &s = stats[node->get_type()];
+        s.count++;
+        s.memsize += node->get_memsize();
+      }
+    });
+
+    std::vector<type_stats_t> &totals = thread_stats[0];
+    for (size_t t = 1; t < thread_stats.size(); ++t) {
+      for (uint32_t i = 0; i <= RUBY_T_MASK; ++i) {
+        totals[i].count += thread_stats[t][i].count;
+        totals[i].memsize += thread_stats[t][i].memsize;
+      }
+    }
+    if (Cancellation::requested()) {
+      return;
+    }
+
+    cached = std::make_shared<cached_reachable_t>();
+    cached->value.count = reachable.get_count();
+    cached->value.totals.swap(totals);
+    cached->bytes += (RUBY_T_MASK + 1) * sizeof(type_stats_t);
+    cache_->put("reachable", obj, "", cached);
+  }
+  size_t count = cached->value.count;
+  const std::vector<type_stats_t> &totals = cached->value.totals;
+
+  std::vector<uint32_t> types;
+  size_t total_memsize = 0;
+  for (uint32_t i = 0; i <= RUBY_T_MASK; ++i) {
+    if (totals[i].count) {
+      types.push_back(i);
+      total_memsize += totals[i].memsize;
+    }
+  }
+  std::sort(types.begin(), types.end(), [&] (uint32_t a, uint32_t b) {
+    return totals[a].memsize > totals[b].memsize;
+  });
+
+  Output::with_handle([&](FILE *out) {
+    fprintf(out, "reachable from 0x%" PRIx64 ": %'zu objects, %'zu bytes", obj->get_addr(),
+        count, total_memsize);
+    if (graph->has_dominator_tree()) {
+      fprintf(out, " (retains %'zu bytes)", graph->get_retained_size(obj));
+    }
+    fprintf(out, "\n%12s %16s  %s\n", "count", "memsize", "type");
+    for (auto type : types) {
+      fprintf(out, "%'12zu %'16zu  %s\n", totals[type].count, totals[type].memsize,
+          RubyHeapObj::get_value_type_string(type));
+    }
+  });
+}
+
+static void
+cmd_whatif(const char *args) {
+  std::vector<std::string> argv;
+  split_args(args, argv);
+
+  RubyHeapObj *from = NULL, *to = NULL;
+  if (argv.size() == 2 && argv[0] == "drop") {
+    to = get_ruby_heap_obj_arg(argv[1].c_str());
+    if (!to) {
+      return;
+    }
+  } else if (argv.size() == 3 && argv[0] == "drop-edge") {
+    from = get_ruby_heap_obj_arg(argv[1].c_str());
+    to = from ? get_ruby_heap_obj_arg(argv[2].c_str()) : NULL;
+    if (!from || !to) {
+      return;
+    }
+    if (from->get_graph() != to->get_graph()) {
+      printf("error: both objects must be in the same graph\n");
+      return;
+    }
+  } else {
+    printf("usage: whatif drop <addr> | whatif drop-edge <from> <to>\n");
+    return;
+  }
+
+  if (!to->get_graph()->has_dominator_tree()) {
+    printf("error: whatif needs the dominator tree, which isn't built for a sampled heap\n");
+    return;
+  }
+
+  Graph *graph = to->get_graph();
+  RemovalSimulation simulation(graph);
+  if (!from) {
+    simulation.drop_object(to);
+  } else if (!simulation.drop_edge(from, to)) {
+    printf("error: 0x%" PRIx64 " does not reference 0x%" PRIx64 "\n", from->get_addr(), to->get_addr());
+    return;
+  }
+  if (Cancellation::requested()) {
+    return;
+  }
+
+  // Said before the work starts, since it can take a while
+  if (simulation.get_num_affected() > graph->get_num_nodes() / 2) {
+    printf("note: the dominators of %'zu of %'zu objects have to be recomputed, which is about as slow as "
+        "rebuilding the dominator tree\n", simulation.get_num_affected(), graph->get_num_nodes());
+  }
+  simulation.simulate();
+  if (Cancellation::requested()) {
+    return;
+  }
+
+  Output::with_handle([&](FILE *out) {
+    fprintf(out, "would free %'zu objects, %'zu bytes\n", simulation.get_freed_count(),
+        simulation.get_freed_memsize());
+
+    const std::vector<RemovalSimulation::Change> &changes = simulation.get_changes();
+    if (changes.empty()) {
+      return;
+    }
+    size_t n = std::min<size_t>(20, changes.size());
+    fprintf(out, "\n%'zu retained sizes would change, top %zu:\n", changes.size(), n);
+    fprintf(out, "%16s %16s  %s\n", "before", "after", "object");
+    for (size_t i = 0; i < n; ++i) {
+      char buf[64];
+      RubyHeapObj *obj = changes[i].obj;
+      fprintf(out, "%'16zu %'16zu  ", changes[i].before, changes[i].after);
+      if (obj->is_root_object()) {
+        fprintf(out, "ROOT%s%s%s\n", obj->get_root_name() ? " (" : "",
+            obj->get_root_name() ? obj->get_root_name() : "", obj->get_root_name() ? ")" : "");
+      } else {
+        fprintf(out, "0x%" PRIx64 " (%s)\n", obj->get_addr(), obj->get_object_summary(buf, sizeof(buf)));
+      }
+    }
+  });
+}
+
+static void
+cmd_raw(const char *args) {
+  RubyHeapObj *obj = get_ruby_heap_obj_arg(args);
+  if (!obj) {
+    return;
+  }
+  Graph *graph = obj->get_graph();
+
+  if (!graph->has_offsets()) {
+    printf("error: raw JSON is only available for uncompressed dump files\n");
+    return;
+  }
+
+  std::string json;
+  if (!graph->get_raw_json(obj, json)) {
+    printf("error: unable to read 0x%" PRIx64 ": %d\n", obj->get_addr(), errno);
+    return;
   }
+
+  Output::with_handle([&](FILE *out) {
+    fprintf(out, "%s\n", json.c_str());
+  });
 }
 
 static void
-cmd_quit(const char *) {
-  exit_ = true;
+cmd_extract(const char *args) {
+  std::vector<std::string> argv;
+  split_args(args, argv);
+  if (argv.size() != 2) {
+    printf("usage: extract <addr> <file>\n");
+    return;
+  }
+
+  RubyHeapObj *obj = get_ruby_heap_obj_arg(argv[0].c_str());
+  if (!obj) {
+    return;
+  }
+  Graph *graph = obj->get_graph();
+
+  if (!graph->has_offsets()) {
+    printf("error: extract is only available for uncompressed dump files\n");
+    return;
+  }
+
+  size_t count;
+  if (!graph->extract(obj, argv[1].c_str(), count)) {
+    printf("error: unable to write %s: %d\n", argv[1].c_str(), errno);
+    return;
+  }
+  printf("wrote %'zu objects to %s\n", count, argv[1].c_str());
 }
 
-static void
-cmd_help(const char *) {
-  printf("You can run the following commands:\n\n");
-  for (int i = 0; commands_[i].name != NULL; ++i) {
-    printf("\t%10s - %s\n", commands_[i].name, commands_[i].help);
+// A flame graph frame for obj: its class or type, without per-object
+// details like string values or sizes that would keep siblings apart
+static const char *
+get_frame_label(RubyHeapObj *obj, char *buf, size_t buf_sz) {
+  if (obj->is_root_object()) {
+    snprintf(buf, buf_sz, "ROOT (%s)", obj->get_root_name() ? obj->get_root_name() : "");
+  } else {
+    switch (obj->get_type()) {
+      case RUBY_T_OBJECT:
+      case RUBY_T_ICLASS:
+      case RUBY_T_DATA:
+      case RUBY_T_IMEMO:
+      case RUBY_T_CLASS:
+      case RUBY_T_MODULE:
+        obj->get_object_summary(buf, buf_sz);
+        break;
+      default:
+        snprintf(buf, buf_sz, "%s", RubyHeapObj::get_value_type_string(obj->get_type()));
+        break;
+    }
   }
-  printf("\n");
+  // ';' separates frames in the folded format
+  for (char *p = buf; *p; ++p) {
+    if (*p == ';' || *p == '\n') {
+      *p = ':';
+    }
+  }
+  return buf;
 }
 
 static void
-cmd_diff(const char *args) {
-  if (args == NULL || strlen(args) == 0) {
-    printf("error: you must specify a heap dump file\n");
-    return;
-  }
+cmd_export_flame(const char *args) {
+  // Dominator tree nodes with the same frame path are walked as one group
+  struct group_t {
+    size_t depth;
+    std::string label;
+    std::vector<RubyHeapObj *> members;
+  };
 
-  FILE *f = fopen(args, "r");
-  if (!f) {
-    printf("unable to open %s: %d\n", args, errno);
+  std::vector<std::string> argv;
+  split_args(args, argv);
+
+  const char *filename = NULL;
+  size_t min_bytes = 0;
+  for (size_t i = 0; i < argv.size(); ++i) {
+    if (argv[i] == "--min-bytes" && i + 1 < argv.size()) {
+      min_bytes = strtoull(argv[++i].c_str(), NULL, 0);
+    } else if (!filename) {
+      filename = argv[i].c_str();
+    } else {
+      printf("error: unknown option %s\n", argv[i].c_str());
+      return;
+    }
+  }
+  if (!filename) {
+    printf("usage: export-flame <file> [--min-bytes N]\n");
     return;
   }
 
-  char template_name[] = "harb_diff-XXXXXX";
-  int fd = mkstemp(template_name);
-  if (fd == -1) {
-    printf("unable to create tempfile: %d\n", errno);
+  if (!graph_->has_dominator_tree()) {
+    printf("error: export-flame needs the dominator tree, which isn't built for a sampled heap\n");
     return;
   }
 
-  FILE *out = fdopen(fd, "w");
+  FILE *out = fopen(filename, "w");
   if (!out) {
-    printf("unable to open temp fd: %d", errno);
+    printf("unable to open %s: %d\n", filename, errno);
     return;
   }
+  setvbuf(out, NULL, _IOFBF, 1 << 20);
 
-  Parser p(f);
-  p.parse([&] (RubyHeapObj *obj) {
-    if (!obj->is_root_object() && graph_->get_heap_object(obj->get_addr()) == NULL) {
-      const char *s = p.current_heap_object_json();
-      fprintf(out, "%s\n", s);
+  Progress progress("exporting flame graph", graph_->get_num_nodes());
+  progress.start();
+
+  std::vector<group_t> stack;
+  std::vector<RubyHeapObj *> children;
+  std::unordered_map<std::string, size_t> child_groups;
+  std::string path;
+  std::vector<size_t> path_lengths;
+  size_t lines = 0;
+  char buf[64];
+
+  // Groups obj's dominator children by label and pushes the groups that
+  // are large enough; returns the memory retained by the ones that aren't
+  auto push_children = [&] (const std::vector<RubyHeapObj *> &members, size_t depth) {
+    size_t first = stack.size();
+    size_t pruned = 0;
+    child_groups.clear();
+    for (auto member : members) {
+      children.clear();
+      graph_->get_dominators(member, children);
+      for (auto child : children) {
+        const char *label = get_frame_label(child, buf, sizeof(buf));
+        auto it = child_groups.find(label);
+        if (it == child_groups.end()) {
+          it = child_groups.insert(std::make_pair(std::string(label), stack.size())).first;
+          stack.push_back(group_t());
+          stack.back().depth = depth;
+          stack.back().label = label;
+        }
+        stack[it->second].members.push_back(child);
+      }
     }
-  });
 
-  fclose(out);
-  fclose(f);
-}
+    if (min_bytes > 0) {
+      size_t kept = first;
+      for (size_t i = first; i < stack.size(); ++i) {
+        size_t retained = 0;
+        for (auto member : stack[i].members) {
+          retained += graph_->get_retained_size(member);
+        }
+        if (retained < min_bytes) {
+          pruned += retained;
+          progress.increment(stack[i].members.size());
+        } else {
+          if (kept != i) {
+            std::swap(stack[kept], stack[i]);
+          }
+          kept++;
+        }
+      }
+      stack.resize(kept);
+    }
+    return pruned;
+  };
 
-static RubyHeapObj *
-get_ruby_heap_obj_arg(const char *args) {
-  if (args == NULL || strlen(args) == 0) {
-    printf("error: you must specify an address\n");
-    return NULL;
+  size_t pruned = push_children(std::vector<RubyHeapObj *>(1, graph_->get_root()), 0);
+  if (pruned > 0) {
+    fprintf(out, "(below --min-bytes) %zu\n", pruned);
+    lines++;
   }
+  while (!stack.empty() && !Cancellation::requested()) {
+    group_t group;
+    std::swap(group, stack.back());
+    stack.pop_back();
 
-  uint64_t addr = strtoull(args, NULL, 0);
-  if (addr == 0) {
-    printf("error: you must specify a valid heap address\n");
-    return NULL;
-  }
+    path_lengths.resize(group.depth);
+    path.resize(group.depth ? path_lengths.back() : 0);
+    if (group.depth) {
+      path += ';';
+    }
+    path += group.label;
+    path_lengths.push_back(path.size());
 
-  RubyHeapObj *obj = graph_->get_heap_object(addr);
-  if (!obj) {
-    printf("error: no ruby object found at address 0x%" PRIx64 "\n", addr);
-    return NULL;
+    // Memory of pruned subtrees is charged to their parent so the totals
+    // still add up
+    size_t weight = push_children(group.members, group.depth + 1);
+    for (auto member : group.members) {
+      weight += member->is_root_object() ? 0 : member->get_memsize();
+    }
+    progress.increment(group.members.size());
+
+    if (weight > 0) {
+      fprintf(out, "%s %zu\n", path.c_str(), weight);
+      lines++;
+    }
   }
 
-  return obj;
+  progress.complete();
+
+  if (fclose(out) != 0) {
+    printf("error writing %s: %d\n", filename, errno);
+    return;
+  }
+  printf("wrote %'zu stacks to %s\n", lines, filename);
 }
 
 static void
-cmd_print(const char *args) {
-  RubyHeapObj *obj = get_ruby_heap_obj_arg(args);
-  if (!obj) {
+cmd_classgraph(const char *args) {
+  typedef std::pair<uintptr_t, uintptr_t> class_pair_t;
+  struct class_pair_hash {
+    size_t operator()(const class_pair_t &p) const {
+      return std::hash<uintptr_t>()(p.first) * 31 + std::hash<uintptr_t>()(p.second);
+    }
+  };
+  struct edge_t {
+    size_t count, bytes;
+  };
+  typedef google::sparse_hash_map<class_pair_t, edge_t, class_pair_hash> edge_map_t;
+
+  std::vector<std::string> argv;
+  split_args(args, argv);
+
+  size_t limit = 20;
+  size_t min_bytes = 0;
+  const char *dot_filename = NULL;
+  for (size_t i = 0; i < argv.size(); ++i) {
+    if (argv[i] == "--min-bytes" && i + 1 < argv.size()) {
+      min_bytes = strtoull(argv[++i].c_str(), NULL, 0);
+    } else if (argv[i] == "--dot" && i + 1 < argv.size()) {
+      dot_filename = argv[++i].c_str();
+    } else if (isdigit(argv[i][0])) {
+      limit = strtoul(argv[i].c_str(), NULL, 0);
+    } else {
+      printf("error: unknown option %s\n", argv[i].c_str());
+      return;
+    }
+  }
+
+  // Every reference counts towards the edge between the two classes, but a
+  // target's memsize is only added once to each edge that leads to it, so an
+  // object referenced many times from one class isn't weighed many times.
+  // Working from each target's referrers makes that a matter of grouping
+  // their classes. Threads count into their own maps, merged once all are
+  // done.
+  size_t num_nodes = graph_->get_num_nodes();
+  std::vector<edge_map_t> thread_edges(parallel_num_threads(num_nodes));
+  parallel_for(num_nodes, [&] (size_t begin, size_t end, size_t thread) {
+    edge_map_t &edges = thread_edges[thread];
+    std::vector<uintptr_t> from;
+    for (size_t i = begin; i < end && !Cancellation::requested(); ++i) {
+      RubyHeapObj *obj = graph_->get_node(i);
+      if (!obj || obj->is_root_object()) {
+        continue;
+      }
+      from.clear();
+      for (auto ref : *obj->get_refs_from()) {
+        if (!ref->is_root_object()) {
+          from.push_back(ref->get_class_key());
+        }
+      }
+      std::sort(from.begin(), from.end());
+      uintptr_t to = obj->get_class_key();
+      for (size_t j = 0; j < from.size(); ) {
+        size_t run = j;
+        while (j < from.size() && from[j] == from[run]) {
+          ++j;
+        }
+        edge_t &e = edges[class_pair_t(from[run], to)];
+        e.count += j - run;
+        e.bytes += obj->get_memsize();
+      }
+    }
+  });
+
+  if (Cancellation::requested()) {
+    return;
+  }
+
+  edge_map_t &totals = thread_edges[0];
+  for (size_t t = 1; t < thread_edges.size(); ++t) {
+    for (auto it : thread_edges[t]) {
+      edge_t &e = totals[it.first];
+      e.count += it.second.count;
+      e.bytes += it.second.bytes;
+    }
+  }
+
+  std::vector<std::pair<class_pair_t, edge_t>> edges;
+  for (auto it : totals) {
+    if (it.second.bytes >= min_bytes) {
+      edges.push_back(it);
+    }
+  }
+  std::sort(edges.begin(), edges.end(), [] (const std::pair<class_pair_t, edge_t> &a, const std::pair<class_pair_t, edge_t> &b) {
+    return a.second.bytes > b.second.bytes;
+  });
+
+  if (dot_filename) {
+    FILE *out = fopen(dot_filename, "w");
+    if (!out) {
+      printf("error: unable to open %s: %d\n", dot_filename, errno);
+      return;
+    }
+    auto write_id = [&] (const char *label) {
+      fputc('"', out);
+      for (const char *p = label; *p; ++p) {
+        if (*p == '"' || *p == '\\') {
+          fputc('\\', out);
+        }
+        fputc(*p, out);
+      }
+      fputc('"', out);
+    };
+    fprintf(out, "digraph classes {\n");
+    for (auto &edge : edges) {
+      fprintf(out, "  ");
+      write_id(RubyHeapObj::get_class_key_label(edge.first.first));
+      fprintf(out, " -> ");
+      write_id(RubyHeapObj::get_class_key_label(edge.first.second));
+      fprintf(out, " [label=\"%zu refs, %zu bytes\"];\n", edge.second.count, edge.second.bytes);
+    }
+    fprintf(out, "}\n");
+    if (fclose(out) != 0) {
+      printf("error: error writing %s: %d\n", dot_filename, errno);
+      return;
+    }
+    printf("wrote %'zu edges to %s\n", edges.size(), dot_filename);
     return;
   }
 
+  limit = std::min(limit, edges.size());
   Output::with_handle([&](FILE *out) {
-    obj->print_object(out);
+    fprintf(out, "top %zu of %'zu class references by the memsize of their distinct targets:\n", limit, edges.size());
+    fprintf(out, "%12s %16s  %s\n", "references", "memsize", "edge");
+    for (size_t i = 0; i < limit; ++i) {
+      fprintf(out, "%'12zu %'16zu  %s -> %s\n", edges[i].second.count, edges[i].second.bytes,
+        RubyHeapObj::get_class_key_label(edges[i].first.first), RubyHeapObj::get_class_key_label(edges[i].first.second));
+    }
   });
 }
 
 static void
-cmd_idom(const char *args) {
-  RubyHeapObj *obj = get_ruby_heap_obj_arg(args);
-  if (!obj || obj->is_root_object()) {
+cmd_find(const char *args) {
+  std::string error;
+  Query *query = Query::compile(graph_, args ? args : "", error);
+  if (!query) {
+    printf("error: %s\n", error.c_str());
     return;
   }
 
-  RubyHeapObj *idom = graph_->get_idom(obj);
+  Query::Result result;
+  query->execute(result);
+  if (Cancellation::requested()) {
+    delete query;
+    return;
+  }
 
   Output::with_handle([&](FILE *out) {
-    if (idom) {
-      fprintf(out, "dominator for 0x%" PRIx64 ":\n", obj->get_addr());
-      idom->print_ref_object(out);
-    } else {
-      fprintf(out, "could not determine dominator for 0x%" PRIx64 ": ", obj->get_addr());
+    switch (query->get_aggregate()) {
+      case Query::kCount:
+        fprintf(out, "%'zu objects, %'zu bytes\n", result.count, result.memsize);
+        break;
+      case Query::kSum:
+        fprintf(out, "%'zu objects, %s %'zu\n", result.count, Query::get_field_name(query->get_sum_field()), result.sum);
+        break;
+      case Query::kGroupByClass:
+      case Query::kGroupByType: {
+        bool has_sum = query->get_sum_field() != Query::kMemsize;
+        fprintf(out, "%'zu objects, %'zu bytes\n", result.count, result.memsize);
+        fprintf(out, "%12s %16s", "count", "memsize");
+        if (has_sum) {
+          fprintf(out, " %16s", Query::get_field_name(query->get_sum_field()));
+        }
+        fprintf(out, "  %s\n", query->get_aggregate() == Query::kGroupByClass ? "class" : "type");
+        for (auto &group : result.groups) {
+          fprintf(out, "%'12zu %'16zu", group.count, group.memsize);
+          if (has_sum) {
+            fprintf(out, " %'16zu", group.sum);
+          }
+          fprintf(out, "  %s\n", RubyHeapObj::get_class_key_label(group.key));
+        }
+        break;
+      }
+      case Query::kList:
+        fprintf(out, "%'zu objects, %'zu bytes%s\n", result.count, result.memsize,
+          result.objects.size() < result.count ? " (limited)" : "");
+        fprintf(out, "%16s %12s  %s\n", "retained", "memsize", "object");
+        for (auto obj : result.objects) {
+          char buf[64];
+          fprintf(out, "%'16zu %'12zu  0x%" PRIx64 " (%s)\n", graph_->get_retained_size(obj), obj->get_memsize(),
+            obj->get_addr(), obj->get_object_summary(buf, sizeof(buf)));
+        }
+        break;
     }
   });
+  delete query;
 }
 
 static void
-cmd_dominators(const char * args) {
-  RubyHeapObj *obj = get_ruby_heap_obj_arg(args);
-  if (!obj || obj->is_root_object()) {
-    return;
+cmd_collections(const char *args) {
+  size_t limit = args && isdigit(args[0]) ? strtoul(args, NULL, 0) : 10;
+  bool by_retained = graph_->has_dominator_tree();
+
+  auto longer = [] (RubyHeapObj *a, RubyHeapObj *b) {
+    return a->get_size() > b->get_size();
+  };
+  auto retained_more = [&] (RubyHeapObj *a, RubyHeapObj *b) {
+    return graph_->get_retained_size(a) > graph_->get_retained_size(b);
+  };
+
+  // One scan keeps a min-heap per thread for each ranking
+  struct collection_stats_t {
+    size_t count, entries;
+    std::vector<RubyHeapObj *> by_size, by_retained;
+  };
+  size_t num_nodes = graph_->get_num_nodes();
+  std::vector<collection_stats_t> thread_stats(parallel_num_threads(num_nodes));
+  parallel_for(num_nodes, [&] (size_t begin, size_t end, size_t thread) {
+    collection_stats_t &stats = thread_stats[thread];
+    stats.count = stats.entries = 0;
+    for (size_t i = begin; i < end; ++i) {
+      RubyHeapObj *obj = graph_->get_node(i);
+      if (!obj || (obj->get_type() != RUBY_T_HASH && obj->get_type() != RUBY_T_ARRAY)) {
+        continue;
+      }
+      stats.count++;
+      stats.entries += obj->get_size();
+      add_top(stats.by_size, obj, limit, longer);
+      if (by_retained) {
+        add_top(stats.by_retained, obj, limit, retained_more);
+      }
+    }
+  });
+
+  collection_stats_t totals = { 0, 0 };
+  for (auto &stats : thread_stats) {
+    totals.count += stats.count;
+    totals.entries += stats.entries;
+    totals.by_size.insert(totals.by_size.end(), stats.by_size.begin(), stats.by_size.end());
+    totals.by_retained.insert(totals.by_retained.end(), stats.by_retained.begin(), stats.by_retained.end());
   }
+  std::sort(totals.by_size.begin(), totals.by_size.end(), longer);
+  std::sort(totals.by_retained.begin(), totals.by_retained.end(), retained_more);
+  totals.by_size.resize(std::min(limit, totals.by_size.size()));
+  totals.by_retained.resize(std::min(limit, totals.by_retained.size()));
+
+  auto print_collections = [&] (FILE *out, std::vector<RubyHeapObj *> &objs) {
+    fprintf(out, "%12s %16s %12s  %s\n", "length", "retained", "memsize", "object");
+    for (auto obj : objs) {
+      char buf[64];
+      fprintf(out, "%'12u %'16zu %'12zu  0x%" PRIx64 " (%s)\n", obj->get_size(), graph_->get_retained_size(obj),
+        obj->get_memsize(), obj->get_addr(), obj->get_object_summary(buf, sizeof(buf)));
+    }
+  };
 
   Output::with_handle([&](FILE *out) {
-    fprintf(out, "0x%" PRIx64 " dominates:\n", obj->get_addr());
+    fprintf(out, "%'zu hashes and arrays with %'zu entries\n", totals.count, totals.entries);
+    fprintf(out, "\nlongest:\n");
+    print_collections(out, totals.by_size);
+    if (by_retained) {
+      fprintf(out, "\nlargest by retained size:\n");
+      print_collections(out, totals.by_retained);
+    }
+  });
+}
 
-    std::vector<RubyHeapObj *> dominators;
-    graph_->get_dominators(obj, dominators);
+// Objects grouped by class (see RubyHeapObj::get_class_key), with a few
+// example addresses
+struct composition_t {
+  static const size_t kSamples = 3;
 
-    if (!dominators.empty()) {
-      for (auto child : dominators) {
-        child->print_ref_object(out);
-      }
-    } else {
-      fprintf(out, "0x%" PRIx64 " does not dominate any objects\n", obj->get_addr());
+  size_t count, memsize;
+  std::vector<uint64_t> samples;
+
+  composition_t() : count(0), memsize(0) {}
+
+  void add(RubyHeapObj *obj) {
+    count++;
+    memsize += obj->get_memsize();
+    if (samples.size() < kSamples) {
+      samples.push_back(obj->get_addr());
     }
+  }
+};
+typedef google::sparse_hash_map<uintptr_t, composition_t> composition_map_t;
+
+static void
+print_composition(FILE *out, composition_map_t &composition) {
+  std::vector<std::pair<uintptr_t, composition_t>> groups(composition.begin(), composition.end());
+  std::sort(groups.begin(), groups.end(), [] (const std::pair<uintptr_t, composition_t> &a, const std::pair<uintptr_t, composition_t> &b) {
+    return a.second.memsize > b.second.memsize;
   });
+
+  fprintf(out, "%12s %16s  %-32s %s\n", "count", "memsize", "class", "e.g.");
+  for (auto &group : groups) {
+    fprintf(out, "%'12zu %'16zu  %-32s", group.second.count, group.second.memsize, RubyHeapObj::get_class_key_label(group.first));
+    for (auto addr : group.second.samples) {
+      fprintf(out, " 0x%" PRIx64, addr);
+    }
+    fprintf(out, "\n");
+  }
 }
 
 static void
-cmd_rootpath(const char *args) {
-  bool found = false;
+cmd_contents(const char *args) {
   RubyHeapObj *obj = get_ruby_heap_obj_arg(args);
   if (!obj) {
     return;
   }
+  Graph *graph = obj->get_graph();
 
-  RubyHeapObj *cur;
-  std::deque<RubyHeapObj *> q;
-  google::sparse_hash_set<RubyHeapObj *> visited;
-  google::sparse_hash_map<RubyHeapObj *, RubyHeapObj *> parent;
-
-  q.push_back(obj);
-  visited.insert(obj);
-
-  while (!q.empty() && !found) {
-    cur = q.front();
-    q.pop_front();
+  composition_map_t references;
+  if (obj->has_refs_to()) {
+    for (size_t i = 0; obj->get_refs_to(i); ++i) {
+      references[obj->get_refs_to(i)->get_class_key()].add(obj->get_refs_to(i));
+    }
+  }
 
-    for (auto ref : *(cur->get_refs_from())) {
-      if (visited.find(ref) == visited.end()) {
-        visited.insert(ref);
-        parent[ref] = cur;
-        if (ref->is_root_object()) {
-          cur = ref;
-          found = true;
-          break;
-        }
-        q.push_back(ref);
+  // One walk of the dominated subtree, which is cached since large subtrees
+  // take a while to walk
+  typedef ResultCache::Value<composition_map_t> cached_composition_t;
+  std::shared_ptr<cached_composition_t> cached = cache_->get<cached_composition_t>("contents", obj);
+  if (!cached) {
+    cached = std::make_shared<cached_composition_t>();
+    composition_map_t &dominated = cached->value;
+    if (graph->has_dominator_tree()) {
+      std::vector<RubyHeapObj *> stack;
+      graph->get_dominators(obj, stack);
+      while (!stack.empty() && !Cancellation::requested()) {
+        RubyHeapObj *cur = stack.back();
+        stack.pop_back();
+        dominated[cur->get_class_key()].add(cur);
+        graph->get_dominators(cur, stack);
       }
     }
-  }
 
-  Output::with_handle([&](FILE *out) {
-    if (!found) {
-      fprintf(out, "error: could not find path to root for 0x%" PRIx64 "\n", obj->get_addr());
+    if (Cancellation::requested()) {
       return;
     }
+    cached->bytes += dominated.size() * (sizeof(std::pair<uintptr_t, composition_t>) +
+        composition_t::kSamples * sizeof(uint64_t));
+    cache_->put("contents", obj, "", cached);
+  }
+  composition_map_t &dominated = cached->value;
 
-    fprintf(out, "root path to 0x%" PRIx64 ":\n", obj->get_addr());
-    while (cur != NULL) {
-      cur->print_ref_object(out);
-      cur = parent[cur];
+  Output::with_handle([&](FILE *out) {
+    char buf[64];
+    fprintf(out, "0x%" PRIx64 " (%s)\n", obj->get_addr(), obj->get_object_summary(buf, sizeof(buf)));
+    fprintf(out, "\nreferences:\n");
+    print_composition(out, references);
+    if (graph->has_dominator_tree()) {
+      fprintf(out, "\ndominates:\n");
+      print_composition(out, dominated);
     }
-    fprintf(out, "\n");
   });
 }
 
+// Set while run_command() is waiting on a command
+static volatile sig_atomic_t command_running_ = 0;
+
+static void
+handle_sigint(int) {
+  if (command_running_ && Cancellation::requested()) {
+    // A second ^C while a command ignores the first one exits. At the
+    // prompt there's nothing to cancel, so ^C never exits there.
+    signal(SIGINT, SIG_DFL);
+    raise(SIGINT);
+  }
+  Cancellation::request();
+}
+
+// Runs a command on a worker thread, so that ^C (or the timeout, if it's
+// not 0) can cancel it and return to the prompt instead of killing the
+// process and the loaded graph with it.
+static void
+run_command(command_t *c, const char *args, double timeout) {
+  std::mutex mutex;
+  std::condition_variable cond;
+  bool done = false;
+  bool timed_out = false;
+
+  Cancellation::reset();
+  command_running_ = 1;
+  std::thread worker([&] {
+    c->func(args);
+    std::lock_guard<std::mutex> lock(mutex);
+    done = true;
+    cond.notify_all();
+  });
+
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (timeout > 0) {
+      auto deadline = std::chrono::steady_clock::now() +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout));
+      if (!cond.wait_until(lock, deadline, [&] { return done; })) {
+        timed_out = true;
+        Cancellation::request();
+      }
+    }
+    cond.wait(lock, [&] { return done; });
+  }
+  worker.join();
+  command_running_ = 0;
+
+  if (timed_out) {
+    printf("%s timed out after %g seconds\n", c->name, timeout);
+  } else if (Cancellation::requested()) {
+    printf("%s interrupted\n", c->name);
+  }
+  Cancellation::reset();
+}
+
 static void execute_command(char *line) {
   char *cmd = line;
   char *args;
@@ -295,10 +2397,35 @@ static void execute_command(char *line) {
     }
   }
 
+  // timeout <secs> <command> cancels the command if it runs for too long
+  double timeout = 0;
+  if (strcmp(cmd, "timeout") == 0) {
+    char *rest;
+    timeout = strtod(args, &rest);
+    if (rest == args || timeout <= 0) {
+      printf("usage: timeout <seconds> <command>\n");
+      return;
+    }
+    while (*rest == ' ') {
+      rest++;
+    }
+    cmd = rest;
+    args = rest;
+    while (*args != ' ' && *args != '\0') {
+      args++;
+    }
+    if (*args != '\0') {
+      *args++ = '\0';
+      while (*args == ' ') {
+        args++;
+      }
+    }
+  }
+
   for (int i = 0; commands_[i].name != NULL; ++i) {
     command_t *c = &commands_[i];
     if (strcmp(c->name, cmd) == 0) {
-      c->func(args);
+      run_command(c, args, timeout);
       return;
     }
   }
@@ -306,13 +2433,89 @@ static void execute_command(char *line) {
   printf("unknown command: %s\n", cmd);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Completion
+///////////////////////////////////////////////////////////////////////////////
+
+static std::vector<std::string> completions_;
+
+static char *
+completion_generator(const char *, int state) {
+  static size_t next;
+  if (state == 0) {
+    next = 0;
+  }
+  return next < completions_.size() ? strdup(completions_[next++].c_str()) : NULL;
+}
+
+static char **
+complete(const char *text, int start, int) {
+  completions_.clear();
+  rl_completion_append_character = ' ';
+
+  // name:0x... completes an address in another loaded dump
+  Completer *completer = completer_;
+  std::string graph_prefix;
+  const char *colon = strchr(text, ':');
+  if (start > 0 && colon) {
+    auto it = graphs_.find(std::string(text, colon - text));
+    if (it == graphs_.end()) {
+      return NULL;
+    }
+    completer = it->second.completer;
+    graph_prefix.assign(text, colon + 1 - text);
+  }
+  const char *word = text + graph_prefix.size();
+
+  if (start == 0) {
+    for (int i = 0; commands_[i].name != NULL; ++i) {
+      if (strncmp(commands_[i].name, text, strlen(text)) == 0) {
+        completions_.push_back(commands_[i].name);
+      }
+    }
+  } else if (completer->complete_address(word, completions_)) {
+    for (auto &completion : completions_) {
+      completion.insert(0, graph_prefix);
+    }
+  } else if (graph_prefix.empty() && isupper(text[0])) {
+    completer->complete_class_name(text, completions_);
+  } else {
+    // Anything else is probably a file name
+    return NULL;
+  }
+
+  // The common prefix of too many matches isn't a complete word yet
+  if (start > 0 && completer->is_partial()) {
+    rl_completion_append_character = '\0';
+  }
+
+  rl_attempted_completion_over = 1;
+  return rl_completion_matches(text, completion_generator);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Main
 ///////////////////////////////////////////////////////////////////////////////
 
+static struct option long_options_[] = {
+  { "profile-json", required_argument, NULL, 'p' },
+  { "summary", no_argument, NULL, 's' },
+  { "sample", required_argument, NULL, 'r' },
+  { "value-bytes", required_argument, NULL, 'v' },
+  { "workdir", required_argument, NULL, 'w' },
+  { "resume", no_argument, NULL, 'R' },
+  { NULL, 0, NULL, 0 }
+};
+
 int
 main(int argc, char **argv) {
   char *line;
+  const char *profile_filename = NULL;
+  const char *workdir = NULL;
+  bool summary_only = false;
+  bool resume = false;
+  double sample_rate = 1;
+  int opt;
 
   Output::initialize();
 
@@ -320,18 +2523,119 @@ main(int argc, char **argv) {
 
   setvbuf(stdout, NULL, _IONBF, 0);
 
-  if (argc < 2) {
+  while ((opt = getopt_long(argc, argv, "", long_options_, NULL)) != -1) {
+    switch (opt) {
+      case 'p':
+        profile_filename = optarg;
+        break;
+      case 's':
+        summary_only = true;
+        break;
+      case 'r':
+        sample_rate = strtod(optarg, NULL);
+        if (!(sample_rate > 0 && sample_rate <= 1)) {
+          fatal_error("sample rate must be in (0, 1]\n");
+        }
+        break;
+      case 'v':
+        value_bytes_ = strtoul(optarg, NULL, 0);
+        break;
+      case 'w':
+        workdir = optarg;
+        break;
+      case 'R':
+        resume = true;
+        break;
+      default:
+        fatal_error("usage: harb [--profile-json <file>] [--summary] [--sample <rate>] [--value-bytes <n>] "
+            "[--workdir <dir> [--resume]] <heap_dump_file|->\n");
+    }
+  }
+
+  if (optind >= argc) {
     fatal_error("objectspace json dump file required\n");
     return -1;
   }
 
-  const char *heap_filename = argv[1];
-  FILE *heap_file = fopen(heap_filename, "r");
+  const char *heap_filename = argv[optind];
+
+  if (resume && !workdir) {
+    fatal_error("--resume needs the --workdir the checkpoints were written to\n");
+  }
+
+  if (summary_only) {
+    HeapSummary *summary = HeapSummary::summarize(heap_filename);
+    if (!summary) {
+      fatal_error("unable to read %s: %d\n", heap_filename, errno);
+    }
+    summary->print(stdout, 20);
+    delete summary;
+    return 0;
+  }
+
+  InputStream *heap_file = InputStream::open(heap_filename);
   if (!heap_file) {
     fatal_error("unable to open %s: %d\n", heap_filename, errno);
   }
 
-  graph_ = new Graph(heap_file);
+  Checkpoint *checkpoint = NULL;
+  if (workdir) {
+    checkpoint = new Checkpoint(workdir, resume);
+    if (!checkpoint->set_source(heap_file, sample_rate, value_bytes_)) {
+      fprintf(stderr, "warning: %s\n", checkpoint->get_error());
+      delete checkpoint;
+      checkpoint = NULL;
+    }
+  }
+
+  strings_ = new StringPool();
+  cache_ = new ResultCache(64 << 20);
+  graph_ = new Graph(heap_file, sample_rate, strings_, value_bytes_, checkpoint);
+  if (heap_file->get_error()) {
+    fatal_error("error reading %s: %d\n", heap_filename, heap_file->get_error());
+  }
+  delete heap_file;
+  if (checkpoint && checkpoint->get_error()) {
+    fprintf(stderr, "warning: %s\n", checkpoint->get_error());
+  }
+  delete checkpoint;
+  graphs_["a"].graph = graph_;
+  graphs_["a"].completer = new Completer(graph_);
+  graphs_["a"].filename = heap_filename;
+  use_graph("a");
+
+  // The dump was piped in on stdin, so read commands from the terminal
+  if (strcmp(heap_filename, "-") == 0) {
+    FILE *tty = fopen("/dev/tty", "r");
+    if (tty) {
+      rl_instream = tty;
+    }
+  }
+
+  if (isatty(STDOUT_FILENO)) {
+    Progress::print_phases(stdout);
+  }
+
+  if (profile_filename) {
+    FILE *profile_file = fopen(profile_filename, "w");
+    if (!profile_file) {
+      fatal_error("unable to open %s: %d\n", profile_filename, errno);
+    }
+    if (!Progress::write_phases_json(profile_file)) {
+      fatal_error("unable to write %s: %d\n", profile_filename, errno);
+    }
+    fclose(profile_file);
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handle_sigint;
+  sa.sa_flags = SA_RESTART;
+  sigaction(SIGINT, &sa, NULL);
+  // Quitting the pager early shouldn't take harb down with it
+  signal(SIGPIPE, SIG_IGN);
+
+  rl_attempted_completion_function = complete;
 
   while (!exit_) {
     line = readline("harb> ");
@@ -0,0 +1,51 @@
+#ifndef HARB_OFFSET_INDEX_H
+#define HARB_OFFSET_INDEX_H
+
+#include <inttypes.h>
+
+#include <vector>
+
+#include "sparsehash/sparse_hash_map"
+
+namespace harb {
+
+// Where each object's JSON is in the dump file, by node index. Each entry
+// packs a 48-bit offset with a 16-bit length into 8 bytes; the few objects
+// longer than that keep their length in an overflow map.
+class OffsetIndex {
+  typedef google::sparse_hash_map<uint32_t, uint64_t> OverflowMap;
+
+  static const uint64_t kMaxLength = 0xffff;
+
+  std::vector<uint64_t> entries_;
+  OverflowMap overflow_;
+
+public:
+  void add(uint32_t idx, uint64_t offset, uint64_t length) {
+    if (entries_.size() <= idx) {
+      entries_.resize(idx + 1, 0);
+    }
+    if (length >= kMaxLength) {
+      overflow_[idx] = length;
+      length = kMaxLength;
+    }
+    entries_[idx] = (offset << 16) | length;
+  }
+
+  // Returns false if idx has no entry
+  bool get(uint32_t idx, uint64_t &offset, uint64_t &length) {
+    if (idx >= entries_.size() || entries_[idx] == 0) {
+      return false;
+    }
+    offset = entries_[idx] >> 16;
+    length = entries_[idx] & kMaxLength;
+    if (length == kMaxLength) {
+      length = overflow_[idx];
+    }
+    return true;
+  }
+};
+
+}
+
+#endif // HARB_OFFSET_INDEX_H
@@ -0,0 +1,51 @@
+#ifndef HARB_PARALLEL_H
+#define HARB_PARALLEL_H
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace harb {
+
+// Below this many items per thread a scan is not worth splitting up
+static const size_t kParallelMinChunk = 1 << 14;
+
+inline size_t parallel_concurrency() {
+  size_t n = std::thread::hardware_concurrency();
+  return n > 0 ? n : 1;
+}
+
+// Returns the number of threads parallel_for will use for n items, so
+// callers can size per-thread state up front.
+inline size_t parallel_num_threads(size_t n) {
+  size_t threads = std::min(parallel_concurrency(), (n + kParallelMinChunk - 1) / kParallelMinChunk);
+  return std::max<size_t>(threads, 1);
+}
+
+// Splits [0, n) into contiguous ranges and calls func(begin, end, thread)
+// for each range on its own thread, where thread is in
+// [0, parallel_num_threads(n)). Returns once every range is done.
+template<typename Func> void parallel_for(size_t n, Func func) {
+  size_t num_threads = parallel_num_threads(n);
+  if (num_threads == 1) {
+    func((size_t) 0, n, (size_t) 0);
+    return;
+  }
+
+  std::vector<std::thread> threads;
+  size_t chunk = (n + num_threads - 1) / num_threads;
+  for (size_t t = 0; t < num_threads; ++t) {
+    size_t begin = std::min(n, t * chunk);
+    size_t end = std::min(n, begin + chunk);
+    threads.push_back(std::thread([=, &func] { func(begin, end, t); }));
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+}
+
+#endif // HARB_PARALLEL_H
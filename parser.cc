@@ -2,28 +2,101 @@
 
 namespace harb {
 
-Parser::Parser(FILE *f) : heap_obj_count_(0), f_(f), heap_obj_json_(NULL), heap_obj_json_size_(0) {}
+Parser::Parser(InputStream *stream, StringPool *strings)
+  : heap_obj_count_(0), strings_(strings), owns_strings_(strings == NULL), stream_(stream), capture_json_(false), streaming_(false), scratch_obj_(NULL), value_bytes_(0) {
+  if (owns_strings_) {
+    strings_ = new StringPool();
+  }
+  set_sample_rate(1);
+  handler_.obj_start_pos_ = handler_.obj_end_pos_ = 0;
+  handler_.gc_flag_ = 0;
+  handler_.skip_ = handler_.has_type_ = false;
+
+  AllocSite none = { NULL, 0, NULL };
+  alloc_sites_.push_back(none);
+}
 
 Parser::~Parser() {
-  if (heap_obj_json_) {
-    free(heap_obj_json_);
-    heap_obj_json_ = NULL;
+  delete scratch_obj_;
+  if (owns_strings_) {
+    delete strings_;
   }
 }
 
 const char * Parser::get_intern_string(const char *str) {
-  assert(str);
-  auto it = intern_strings_.find(str);
-  if (it != intern_strings_.end()) {
-    return *it;
+  return strings_->intern(str);
+}
+
+uint32_t Parser::get_alloc_site_id(const AllocSite &site) {
+  auto it = alloc_site_ids_.find(site);
+  if (it != alloc_site_ids_.end()) {
+    return it->second;
   }
-  const char *dup = strdup(str);
-  intern_strings_.insert(dup);
-  return dup;
+  uint32_t id = alloc_sites_.size();
+  alloc_sites_.push_back(site);
+  alloc_site_ids_[site] = id;
+  return id;
 }
 
 RubyHeapObj * Parser::create_heap_object(RubyValueType type) {
-  return new RubyHeapObj(NULL, type, ++heap_obj_count_);
+  ++heap_obj_count_;
+  if (scratch_obj_) {
+    RubyHeapObj *obj = scratch_obj_;
+    *obj = RubyHeapObj(NULL, type, heap_obj_count_);
+    if (!streaming_) {
+      scratch_obj_ = NULL;
+    }
+    return obj;
+  }
+
+  RubyHeapObj *obj = new RubyHeapObj(NULL, type, heap_obj_count_);
+  if (streaming_) {
+    scratch_obj_ = obj;
+  }
+  return obj;
+}
+
+void Parser::discard_heap_object(RubyHeapObj *obj) {
+  assert(obj->idx == (uint32_t) heap_obj_count_);
+  assert(!scratch_obj_ || scratch_obj_ == obj);
+  heap_obj_count_--;
+  scratch_obj_ = obj;
+}
+
+static inline uint64_t splitmix64(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+static inline bool is_always_sampled(RubyValueType type) {
+  // Class objects are kept so that sampled objects can still be labelled
+  return type == RUBY_T_CLASS || type == RUBY_T_MODULE || type == RUBY_T_ICLASS || type == RUBY_T_ROOT;
+}
+
+double Parser::get_inclusion_probability(RubyHeapObj *obj) {
+  return is_always_sampled(obj->get_type()) ? 1.0 : sample_rate_;
+}
+
+bool Parser::is_sampled(RubyHeapObj *obj) {
+  if (sample_rate_ >= 1 || is_always_sampled(obj->get_type())) {
+    return true;
+  }
+  return splitmix64(obj->get_addr()) < sample_threshold_;
+}
+
+void Parser::set_sample_rate(double rate) {
+  sample_rate_ = rate;
+  sample_threshold_ = rate >= 1 ? UINT64_MAX : (uint64_t) (rate * 18446744073709551616.0);
+}
+
+void Parser::HeapDumpHandler::update_sampling() {
+  // The decision needs both the address and the type, in whichever order
+  // they appear
+  if (parser_->sample_rate_ < 1 && obj_->get_addr() && has_type_) {
+    skip_ = !parser_->is_sampled(obj_);
+  }
 }
 
 bool Parser::HeapDumpHandler::StartObject() {
@@ -33,6 +106,12 @@ bool Parser::HeapDumpHandler::StartObject() {
       obj_ = parser_->create_heap_object(RUBY_T_NONE);
       state_ = kInsideObject;
       obj_start_pos_ = stream_->Tell() - 1;
+      skip_ = has_type_ = false;
+      site_.file = site_.method = NULL;
+      site_.line = 0;
+      if (parser_->capture_json_) {
+        stream_->start_capture("{");
+      }
       return true;
     default:
       return true;
@@ -44,6 +123,12 @@ bool Parser::HeapDumpHandler::EndObject(rapidjson::SizeType memberCount __attrib
     case kInsideObject:
       obj_end_pos_ = stream_->Tell();
       state_ = kFinishObject;
+      if (!skip_ && (site_.file || site_.method)) {
+        obj_->as.obj.alloc_site = parser_->get_alloc_site_id(site_);
+      }
+      if (parser_->capture_json_) {
+        stream_->end_capture();
+      }
       return true;
     case kFlags:
       state_ = kInsideObject;
@@ -86,6 +171,29 @@ bool Parser::HeapDumpHandler::Key(const char* str, rapidjson::SizeType length, b
         state_ = kStruct;
       } else if (strncmp(str, "root", length) == 0) {
         state_ = kRoot;
+      } else if (strncmp(str, "file", length) == 0) {
+        state_ = kFile;
+      } else if (strncmp(str, "line", length) == 0) {
+        state_ = kLine;
+      } else if (strncmp(str, "method", length) == 0) {
+        state_ = kMethod;
+      } else if (strncmp(str, "generation", length) == 0) {
+        state_ = kGeneration;
+      } else if (strncmp(str, "slot_size", length) == 0) {
+        state_ = kSlotSize;
+      }
+      return true;
+    case kFlags:
+      if (strncmp(str, "old", length) == 0) {
+        gc_flag_ = RUBY_FL_GC_OLD;
+      } else if (strncmp(str, "marked", length) == 0) {
+        gc_flag_ = RUBY_FL_GC_MARKED;
+      } else if (strncmp(str, "wb_protected", length) == 0) {
+        gc_flag_ = RUBY_FL_GC_WB_PROTECTED;
+      } else if (strncmp(str, "uncollectible", length) == 0) {
+        gc_flag_ = RUBY_FL_GC_UNCOLLECTIBLE;
+      } else {
+        gc_flag_ = 0;
       }
       return true;
     default:
@@ -93,16 +201,26 @@ bool Parser::HeapDumpHandler::Key(const char* str, rapidjson::SizeType length, b
   }
 }
 
-bool Parser::HeapDumpHandler::String(const char* str, rapidjson::SizeType length __attribute__((unused)), bool copy __attribute__((unused))) {
+bool Parser::HeapDumpHandler::String(const char* str, rapidjson::SizeType length, bool copy __attribute__((unused))) {
+  if (skip_) {
+    if (state_ != kReferences) {
+      state_ = kInsideObject;
+    }
+    return true;
+  }
+
   switch (state_) {
     case kType:
       obj_->flags |= RubyHeapObj::get_value_type(str);
       state_ = kInsideObject;
+      has_type_ = true;
+      update_sampling();
       return true;
     case kAddress:
       obj_->as.obj.addr = strtoull(str, NULL, 0);
       assert(obj_->as.obj.addr != 0);
       state_ = kInsideObject;
+      update_sampling();
       return true;
     case kClass:
       obj_->as.obj.clazz.addr = strtoull(str, NULL, 0);
@@ -110,7 +228,7 @@ bool Parser::HeapDumpHandler::String(const char* str, rapidjson::SizeType length
       state_ = kInsideObject;
       return true;
     case kReferences:
-      {
+      if (!parser_->streaming_) {
         uint64_t addr = strtoull(str, NULL, 0);
         assert(addr != 0);
         refs_to_.push_back(addr);
@@ -120,13 +238,33 @@ bool Parser::HeapDumpHandler::String(const char* str, rapidjson::SizeType length
     case kStruct:
     case kName:
     case kImemoType:
-      obj_->as.obj.as.value = parser_->get_intern_string(str);
+      if (parser_->streaming_) {
+        parser_->value_.assign(str, length);
+        obj_->as.obj.as.value = parser_->value_.c_str();
+      } else if (state_ == kValue && parser_->value_bytes_ && length > parser_->value_bytes_) {
+        obj_->as.obj.as.value = parser_->strings_->intern_prefix(str, length, parser_->value_bytes_);
+        obj_->flags |= RUBY_FL_TRUNCATED;
+      } else {
+        obj_->as.obj.as.value = parser_->get_intern_string(str);
+      }
       state_ = kInsideObject;
       return true;
     case kRoot:
       obj_->as.root.name = parser_->get_intern_string(str);
       state_ = kInsideObject;
       return true;
+    case kFile:
+      if (!parser_->streaming_) {
+        site_.file = parser_->get_intern_string(str);
+      }
+      state_ = kInsideObject;
+      return true;
+    case kMethod:
+      if (!parser_->streaming_) {
+        site_.method = parser_->get_intern_string(str);
+      }
+      state_ = kInsideObject;
+      return true;
     default:
       return true;
   }
@@ -140,7 +278,9 @@ bool Parser::HeapDumpHandler::StartArray() {
 }
 
 bool Parser::HeapDumpHandler::EndArray(rapidjson::SizeType elementCount) {
-  if (state_ == kReferences) {
+  if (state_ == kReferences && (parser_->streaming_ || skip_)) {
+    state_ = kInsideObject;
+  } else if (state_ == kReferences) {
     size_t i = 0;
     assert(refs_to_.size() == elementCount);
     obj_->refs_to.addr = new uint64_t[refs_to_.size() + 1];
@@ -153,9 +293,34 @@ bool Parser::HeapDumpHandler::EndArray(rapidjson::SizeType elementCount) {
   return true;
 }
 
+bool Parser::HeapDumpHandler::Null() {
+  switch (state_) {
+    case kFile:
+    case kLine:
+    case kMethod:
+    case kGeneration:
+      state_ = kInsideObject;
+      return true;
+    default:
+      return true;
+  }
+}
+
 bool Parser::HeapDumpHandler::Bool(bool b) {
   uint32_t flag = 0;
 
+  if (state_ == kFlags) {
+    if (b && !skip_) {
+      obj_->flags |= gc_flag_;
+    }
+    return true;
+  }
+
+  if (skip_) {
+    state_ = kInsideObject;
+    return true;
+  }
+
   if (b) {
     switch (state_) {
       case kFrozen:
@@ -178,6 +343,13 @@ bool Parser::HeapDumpHandler::Bool(bool b) {
 }
 
 bool Parser::HeapDumpHandler::RawNumber(const char* str, rapidjson::SizeType length __attribute__((unused)), bool copy __attribute__((unused))) {
+  if (skip_) {
+    if (state_ != kReferences) {
+      state_ = kInsideObject;
+    }
+    return true;
+  }
+
   switch (state_) {
     case kMemsize:
       obj_->as.obj.memsize = strtoul(str, NULL, 0);
@@ -188,32 +360,32 @@ bool Parser::HeapDumpHandler::RawNumber(const char* str, rapidjson::SizeType len
       obj_->as.obj.as.size = strtoul(str, NULL, 0);
       state_ = kInsideObject;
       return true;
+    case kLine:
+      site_.line = strtoul(str, NULL, 0);
+      state_ = kInsideObject;
+      return true;
+    case kGeneration:
+      obj_->as.obj.generation = strtoul(str, NULL, 0);
+      state_ = kInsideObject;
+      return true;
+    case kSlotSize: {
+      unsigned long slot_size = strtoul(str, NULL, 0);
+      if (slot_size <= RUBY_SLOT_SIZE_MAX) {
+        obj_->flags |= slot_size << RUBY_SLOT_SIZE_SHIFT;
+      }
+      state_ = kInsideObject;
+      return true;
+    }
     default:
       return true;
   }
 }
 
 const char * Parser::current_heap_object_json() {
-  assert (handler_.state_ != HeapDumpHandler::kFinish || handler_.state_ != HeapDumpHandler::kStart);
-
-  size_t size = handler_.obj_end_pos_ - handler_.obj_start_pos_;
-  assert (size > 0);
-  if (size > heap_obj_json_size_) {
-    if (heap_obj_json_) {
-      delete[] heap_obj_json_;
-    }
-
-    heap_obj_json_ = new char[size+1];
-    heap_obj_json_size_ = size;
-  }
-
-  off_t cur_pos = ftello(f_);
-  fseek(f_, handler_.obj_start_pos_, SEEK_SET);
-  fread(heap_obj_json_, size, 1, f_);
-  heap_obj_json_[size] = '\0';
-  fseek(f_, cur_pos, SEEK_SET);
+  assert(capture_json_);
+  assert(handler_.state_ == HeapDumpHandler::kFinishObject);
 
-  return heap_obj_json_;
+  return stream_->end_capture().c_str();
 }
 
 }
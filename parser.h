@@ -1,25 +1,22 @@
 #ifndef HARB_PARSER_H
 #define HARB_PARSER_H
 
+#include <string>
 #include <vector>
 
+#include "sparsehash/sparse_hash_map"
 #include "sparsehash/sparse_hash_set"
 #include "rapidjson/reader.h"
-#include "rapidjson/filereadstream.h"
 
+#include "input_stream.h"
 #include "ruby_heap_obj.h"
+#include "string_pool.h"
 
 namespace harb {
 
 class Parser {
-  struct eqstr {
-    bool operator()(const char* s1, const char* s2) const {
-      return (s1 == s2) || (s1 && s2 && strcmp(s1, s2) == 0);
-    }
-  };
-
   struct HeapDumpHandler {
-      bool Null() { return true; }
+      bool Null();
       bool Bool(bool b);
       bool Int(int i) { return true; }
       bool Uint(unsigned u) { return true; }
@@ -53,50 +50,133 @@ class Parser {
         kStruct,
         kImemoType,
         kFlags,
-        kRoot
+        kRoot,
+        kFile,
+        kLine,
+        kMethod,
+        kGeneration,
+        kSlotSize
       } state_;
 
       Parser *parser_;
-      rapidjson::FileReadStream *stream_;
+      InputStream *stream_;
       RubyHeapObj *obj_;
       size_t obj_start_pos_, obj_end_pos_;
       std::vector<uint64_t> refs_to_;
+      AllocSite site_;
+      uint32_t gc_flag_; // flag for the current key inside "flags"
+      bool skip_; // object was not selected by sampling
+      bool has_type_;
+
+      void update_sampling();
   };
 
-  typedef google::sparse_hash_set<const char *, std::hash<const char *>, eqstr> StringSet;
+  struct AllocSiteHash {
+    size_t operator()(const AllocSite &site) const {
+      return std::hash<const char *>()(site.file) * 31 + std::hash<const char *>()(site.method) * 17 + site.line;
+    }
+  };
+
+  struct AllocSiteEq {
+    bool operator()(const AllocSite &a, const AllocSite &b) const {
+      return a.file == b.file && a.line == b.line && a.method == b.method;
+    }
+  };
+
+  typedef google::sparse_hash_map<AllocSite, uint32_t, AllocSiteHash, AllocSiteEq> AllocSiteMap;
 
   int32_t heap_obj_count_;
-  StringSet intern_strings_;
+  StringPool *strings_;
+  bool owns_strings_;
+  AllocSiteMap alloc_site_ids_;
+  std::vector<AllocSite> alloc_sites_;
   HeapDumpHandler handler_;
-  FILE *f_;
-  char *heap_obj_json_;
-  size_t heap_obj_json_size_;
+  InputStream *stream_;
+  bool capture_json_;
+  bool streaming_;
+  RubyHeapObj *scratch_obj_;
+  std::string value_;
+  double sample_rate_;
+  uint64_t sample_threshold_;
+  size_t value_bytes_;
 
   const char * get_intern_string(const char *str);
+  uint32_t get_alloc_site_id(const AllocSite &site);
+  void discard_heap_object(RubyHeapObj *obj);
+  bool is_sampled(RubyHeapObj *obj);
 
 public:
 
-  Parser(FILE *f);
+  // Strings are interned into `strings` if given, so several parsers can
+  // share one pool, or into a pool of the parser's own
+  Parser(InputStream *stream, StringPool *strings = NULL);
   ~Parser();
 
   RubyHeapObj* create_heap_object(RubyValueType type);
 
   int32_t get_heap_object_count() { return heap_obj_count_; }
 
+  // Forgets every object created after the first count, so their indexes
+  // are handed out again
+  void discard_heap_objects(int32_t count) { heap_obj_count_ = count; }
+
+  StringPool * get_strings() { return strings_; }
+
+  // Returns the id of site, adding it if it's new. Ids are handed out in
+  // order, so adding another parser's sites in id order keeps their ids.
+  uint32_t add_alloc_site(const AllocSite &site) { return get_alloc_site_id(site); }
+
+  const AllocSite & get_alloc_site(uint32_t id) { return alloc_sites_[id]; }
+
+  size_t get_alloc_site_count() { return alloc_sites_.size(); }
+
+  // Offset of the opening brace of the most recently parsed heap object
+  size_t get_object_start() { return handler_.obj_start_pos_; }
+
+  // Offset just past the most recently parsed heap object
+  size_t get_position() { return handler_.obj_end_pos_; }
+
+  // In streaming mode every object is parsed into the same scratch object,
+  // references are skipped and values and allocation sites are not kept, so
+  // memory use does not grow with the size of the dump. Objects passed to
+  // the parse callback (and their values) are only valid until it returns.
+  void set_streaming(bool streaming) { streaming_ = streaming; }
+
+  // Keep only a deterministic subset of objects, selected by a hash of their
+  // address, plus every class/module (so sampled objects can be labelled)
+  // and ROOT record. Objects that are not selected are never passed to the
+  // parse callback.
+  void set_sample_rate(double rate);
+
+  double get_sample_rate() { return sample_rate_; }
+
+  // Keep only the first max_bytes of longer string values, flagging the
+  // object RUBY_FL_TRUNCATED. 0 (the default) keeps every value whole.
+  void set_value_bytes(size_t max_bytes) { value_bytes_ = max_bytes; }
+
+  size_t get_value_bytes() { return value_bytes_; }
+
+  // The probability that obj was kept when sampling
+  double get_inclusion_probability(RubyHeapObj *obj);
+
+  // Keep the raw JSON of each heap object so current_heap_object_json() can
+  // return it from inside the parse callback
+  void set_capture_json(bool capture) { capture_json_ = capture; }
+
   const char * current_heap_object_json();
 
   template<typename Func> void parse(Func func) {
-    fseeko(f_, 0, SEEK_SET);
-
-    char buf[16384];
     rapidjson::Reader reader;
-    rapidjson::FileReadStream frs(f_, buf, sizeof(buf));
 
     handler_.state_ = HeapDumpHandler::kStart;
     handler_.parser_ = this;
-    handler_.stream_ = &frs;
-    while (reader.Parse<rapidjson::kParseStopWhenDoneFlag | rapidjson::kParseNumbersAsStringsFlag>(frs, handler_)) {
-      func(handler_.obj_);
+    handler_.stream_ = stream_;
+    while (reader.Parse<rapidjson::kParseStopWhenDoneFlag | rapidjson::kParseNumbersAsStringsFlag>(*stream_, handler_)) {
+      if (handler_.skip_) {
+        discard_heap_object(handler_.obj_);
+      } else {
+        func(handler_.obj_);
+      }
     }
 
     handler_.state_ = HeapDumpHandler::kFinish;
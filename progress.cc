@@ -1,48 +1,201 @@
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <chrono>
+
+#include "rapidjson/writer.h"
+#include "rapidjson/filewritestream.h"
+
 #include "progress.h"
 
 namespace harb {
 
-Progress::Progress(const char *message, uint64_t total)
-  : current(0), total(total), percentage(-1), message(message) {
+static const std::chrono::milliseconds kRedrawInterval(100);
+
+std::vector<Progress::Phase> Progress::phases_;
+std::mutex Progress::phases_mutex_;
+
+static double wall_time() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double cpu_time() {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0) {
+    return 0;
+  }
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+Progress::Progress(const char *message, uint64_t total, Unit unit)
+  : current(0), items(0), total(total), percentage(-1), message(message), unit(unit),
+    running(false), start_wall_time(0), start_cpu_time(0), timer(NULL) {
   show_progress = isatty(STDOUT_FILENO) == 1;
 }
 
+Progress::~Progress() {
+  if (timer) {
+    {
+      std::lock_guard<std::mutex> lock(timer_mutex);
+      running = false;
+    }
+    timer_cond.notify_all();
+    timer->join();
+    delete timer;
+  }
+}
+
 void Progress::start() {
   update(0);
+  start_wall_time = wall_time();
+  start_cpu_time = cpu_time();
+
+  if (show_progress && !timer) {
+    running = true;
+    timer = new std::thread(&Progress::run_timer, this);
+  }
+}
+
+void Progress::run_timer() {
+  std::unique_lock<std::mutex> lock(timer_mutex);
+  while (running) {
+    print();
+    timer_cond.wait_for(lock, kRedrawInterval);
+  }
 }
 
 void Progress::complete() {
-  update(total);
-  if (show_progress)
+  if (timer) {
+    {
+      std::lock_guard<std::mutex> lock(timer_mutex);
+      running = false;
+    }
+    timer_cond.notify_all();
+    timer->join();
+    delete timer;
+    timer = NULL;
+  }
+
+  if (total > 0) {
+    update(total);
+  }
+
+  Phase phase;
+  phase.message = message;
+  phase.unit = unit;
+  phase.wall_time = wall_time() - start_wall_time;
+  phase.cpu_time = cpu_time() - start_cpu_time;
+  phase.bytes = unit == kBytes ? current.load(std::memory_order_relaxed) : 0;
+  phase.items = items.load(std::memory_order_relaxed);
+  if (phase.items == 0 && unit == kItems) {
+    phase.items = current.load(std::memory_order_relaxed);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(phases_mutex_);
+    phases_.push_back(phase);
+  }
+
+  if (show_progress) {
+    percentage = -1;
+    print();
     printf("\n");
+  }
 }
 
 void Progress::print() {
-  if (show_progress)
+  if (!show_progress)
+    return;
+
+  uint64_t cur = current.load(std::memory_order_relaxed);
+  double elapsed = start_wall_time > 0 ? wall_time() - start_wall_time : 0;
+
+  if (total == 0) {
+    if (unit == kBytes) {
+      printf("\r%s (%.1f MB)", message, cur / (1024.0 * 1024.0));
+    } else {
+      printf("\r%s (%'" PRIu64 ")", message, cur);
+    }
+    return;
+  }
+
+  int new_percentage = (int) ((cur * 100) / total);
+  if (new_percentage == percentage && elapsed < 1) {
+    return;
+  }
+  percentage = new_percentage;
+
+  if (unit == kBytes && elapsed >= 1) {
+    printf("\r%s (%d%%, %.1f MB/s)  ", message, percentage, cur / (1024.0 * 1024.0) / elapsed);
+  } else {
     printf("\r%s (%d%%)", message, percentage);
+  }
 }
 
 void Progress::clear() {
   if (show_progress)
-    printf("\r%*s\r", (int)strlen(message) + 7, "");
+    printf("\r%*s\r", (int)strlen(message) + 24, "");
 }
 
-void Progress::increment(uint64_t amount) {
-  update(current + amount);
-}
+void Progress::print_phases(FILE *out) {
+  std::lock_guard<std::mutex> lock(phases_mutex_);
+  if (phases_.empty()) {
+    return;
+  }
 
-void Progress::update(uint64_t progress) {
-  this->current = progress;
-  int new_percentage = (progress * 100) / total;
-  if (percentage != new_percentage) {
-    this->percentage = new_percentage;
-    print();
+  double total_wall = 0, total_cpu = 0;
+  fprintf(out, "%-28s %10s %10s %14s %10s\n", "phase", "wall (s)", "cpu (s)", "items/s", "MB/s");
+  for (auto &phase : phases_) {
+    double items_per_sec = phase.wall_time > 0 ? phase.items / phase.wall_time : 0;
+    fprintf(out, "%-28s %10.2f %10.2f %'14.0f", phase.message, phase.wall_time, phase.cpu_time, items_per_sec);
+    if (phase.unit == kBytes && phase.wall_time > 0) {
+      fprintf(out, " %10.1f\n", phase.bytes / (1024.0 * 1024.0) / phase.wall_time);
+    } else {
+      fprintf(out, " %10s\n", "-");
+    }
+    total_wall += phase.wall_time;
+    total_cpu += phase.cpu_time;
   }
+  fprintf(out, "%-28s %10.2f %10.2f\n", "total", total_wall, total_cpu);
 }
 
+bool Progress::write_phases_json(FILE *out) {
+  char buf[4096];
+  rapidjson::FileWriteStream os(out, buf, sizeof(buf));
+  rapidjson::Writer<rapidjson::FileWriteStream> writer(os);
+
+  std::lock_guard<std::mutex> lock(phases_mutex_);
+  writer.StartObject();
+  writer.Key("phases");
+  writer.StartArray();
+  for (auto &phase : phases_) {
+    writer.StartObject();
+    writer.Key("name");
+    writer.String(phase.message);
+    writer.Key("wall_time");
+    writer.Double(phase.wall_time);
+    writer.Key("cpu_time");
+    writer.Double(phase.cpu_time);
+    writer.Key("items");
+    writer.Uint64(phase.items);
+    writer.Key("items_per_sec");
+    writer.Double(phase.wall_time > 0 ? phase.items / phase.wall_time : 0);
+    if (phase.unit == kBytes) {
+      writer.Key("bytes");
+      writer.Uint64(phase.bytes);
+      writer.Key("mb_per_sec");
+      writer.Double(phase.wall_time > 0 ? phase.bytes / (1024.0 * 1024.0) / phase.wall_time : 0);
+    }
+    writer.EndObject();
+  }
+  writer.EndArray();
+  writer.EndObject();
+  os.Put('\n');
+  os.Flush();
+
+  return ferror(out) == 0;
 }
 
+}
@@ -1,26 +1,87 @@
 #ifndef HARB_PROGRESS_H
 #define HARB_PROGRESS_H
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 namespace harb {
 
+// Progress reporting and phase profiling. Counters are relaxed atomics so
+// they can be bumped from hot loops (and from several threads); the display
+// is redrawn by a timer thread rather than on every update. When a phase
+// completes its timings are recorded so they can be reported once loading
+// has finished.
 class Progress {
-  uint64_t current, total;
+  public:
+
+  enum Unit {
+    kItems = 0,
+    kBytes
+  };
+
+  struct Phase {
+    const char *message;
+    Unit unit;
+    uint64_t items;
+    uint64_t bytes;
+    double wall_time;
+    double cpu_time;
+  };
+
+  private:
+
+  std::atomic<uint64_t> current, items;
+  uint64_t total;
   int percentage;
   const char *message;
+  Unit unit;
   bool show_progress;
+  bool running;
+  double start_wall_time, start_cpu_time;
+
+  std::thread *timer;
+  std::mutex timer_mutex;
+  std::condition_variable timer_cond;
+
+  static std::vector<Phase> phases_;
+  static std::mutex phases_mutex_;
+
+  void run_timer();
 
   public:
 
-  Progress(const char *message, uint64_t total);
+  Progress(const char *message, uint64_t total, Unit unit = kItems);
+  ~Progress();
   void start();
   void complete();
   void print();
   void clear();
-  void increment(uint64_t amount=1);
-  void update(uint64_t progress);
+
+  void increment(uint64_t amount=1) {
+    current.fetch_add(amount, std::memory_order_relaxed);
+  }
+
+  void update(uint64_t progress) {
+    current.store(progress, std::memory_order_relaxed);
+  }
+
+  void add_items(uint64_t amount=1) {
+    items.fetch_add(amount, std::memory_order_relaxed);
+  }
+
+  void set_items(uint64_t amount) {
+    items.store(amount, std::memory_order_relaxed);
+  }
+
+  static void print_phases(FILE *out);
+  static bool write_phases_json(FILE *out);
 };
 
 }
@@ -0,0 +1,487 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <strings.h>
+
+#include <algorithm>
+
+#include "sparsehash/sparse_hash_map"
+
+#include "cancellation.h"
+#include "graph.h"
+#include "parallel.h"
+#include "query.h"
+#include "string_pool.h"
+
+namespace harb {
+
+static const struct {
+  const char *name;
+  Query::Field field;
+} kFields[] = {
+  { "type", Query::kType },
+  { "class", Query::kClass },
+  { "value", Query::kValue },
+  { "memsize", Query::kMemsize },
+  { "retained", Query::kRetained },
+  { "size", Query::kSize },
+  { "length", Query::kSize },
+  { "referrers", Query::kReferrers },
+  { "addr", Query::kAddr },
+  { "generation", Query::kGeneration },
+  { "frozen", Query::kFrozen },
+  { "shared", Query::kShared },
+  { NULL, Query::kType }
+};
+
+// Splits a query into words, operators and (possibly quoted) values
+class QueryLexer {
+  const std::string &text;
+  size_t pos;
+
+  void skip_space() {
+    while (pos < text.size() && isspace(text[pos])) {
+      ++pos;
+    }
+  }
+
+  public:
+    QueryLexer(const std::string &text) : text(text), pos(0) {}
+
+    bool done() {
+      skip_space();
+      return pos >= text.size();
+    }
+
+    // An identifier or number
+    std::string word() {
+      skip_space();
+      size_t start = pos;
+      while (pos < text.size() && (isalnum(text[pos]) || text[pos] == '_')) {
+        ++pos;
+      }
+      return text.substr(start, pos - start);
+    }
+
+    std::string peek_word() {
+      size_t saved = pos;
+      std::string w = word();
+      pos = saved;
+      return w;
+    }
+
+    std::string op() {
+      skip_space();
+      size_t start = pos;
+      while (pos < text.size() && strchr("=!<>~", text[pos])) {
+        ++pos;
+      }
+      return text.substr(start, pos - start);
+    }
+
+    // Everything up to the next space, or a "quoted string"
+    std::string value() {
+      skip_space();
+      std::string v;
+      if (pos < text.size() && text[pos] == '"') {
+        for (++pos; pos < text.size() && text[pos] != '"'; ++pos) {
+          if (text[pos] == '\\' && pos + 1 < text.size()) {
+            ++pos;
+          }
+          v += text[pos];
+        }
+        ++pos;
+      } else {
+        while (pos < text.size() && !isspace(text[pos])) {
+          v += text[pos++];
+        }
+      }
+      return v;
+    }
+};
+
+static bool
+parse_field(const std::string &name, Query::Field &field) {
+  for (int i = 0; kFields[i].name; ++i) {
+    if (name == kFields[i].name) {
+      field = kFields[i].field;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char * Query::get_field_name(Field field) {
+  for (int i = 0; kFields[i].name; ++i) {
+    if (kFields[i].field == field) {
+      return kFields[i].name;
+    }
+  }
+  return "?";
+}
+
+// Cheapest predicates are tested first
+static int
+get_cost(Query::Field field, bool regex) {
+  if (regex) {
+    return 3;
+  }
+  switch (field) {
+    case Query::kValue:
+      return 2;
+    case Query::kClass:
+    case Query::kRetained:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+Query::~Query() {
+  for (auto p : predicates) {
+    delete p->regex;
+    delete p;
+  }
+}
+
+Query * Query::compile(Graph *graph, const std::string &text, std::string &error) {
+  Query *query = new Query(graph);
+  QueryLexer lexer(text);
+
+  while (!lexer.done()) {
+    std::string w = lexer.word();
+    if (w == "and") {
+      continue;
+    } else if (w == "limit") {
+      std::string n = lexer.word();
+      if (n.empty() || !isdigit(n[0])) {
+        error = "limit needs a number";
+        break;
+      }
+      query->limit = strtoul(n.c_str(), NULL, 0);
+    } else if (w == "count") {
+      query->aggregate = kCount;
+    } else if (w == "sum") {
+      if (!parse_field(lexer.word(), query->sum_field) || query->sum_field < kMemsize || query->sum_field > kReferrers) {
+        error = "sum needs one of memsize, retained, size or referrers";
+        break;
+      }
+      query->aggregate = kSum;
+    } else if (w == "group") {
+      std::string by = lexer.word(), key = lexer.word();
+      if (by != "by" || (key != "class" && key != "type")) {
+        error = "expected group by class or group by type";
+        break;
+      }
+      query->aggregate = key == "class" ? kGroupByClass : kGroupByType;
+      // "group by class sum retained" totals a field per group too
+      if (lexer.peek_word() == "sum") {
+        lexer.word();
+        if (!parse_field(lexer.word(), query->sum_field) || query->sum_field < kMemsize || query->sum_field > kReferrers) {
+          error = "sum needs one of memsize, retained, size or referrers";
+          break;
+        }
+      }
+    } else {
+      Predicate *p = new Predicate();
+      p->regex = NULL;
+      p->prefix = NULL;
+      p->negate = false;
+      query->predicates.push_back(p);
+      if (w == "not") {
+        p->negate = true;
+        w = lexer.word();
+      }
+      if (!parse_field(w, p->field)) {
+        error = "unknown field '" + w + "'";
+        break;
+      }
+      if (p->field == kFrozen || p->field == kShared) {
+        // A bare flag
+        p->op = kNe;
+        p->number = 0;
+      } else {
+        std::string op = lexer.op();
+        if (op == "=" || op == "==") {
+          p->op = kEq;
+        } else if (op == "!=") {
+          p->op = kNe;
+        } else if (op == "<") {
+          p->op = kLt;
+        } else if (op == "<=") {
+          p->op = kLe;
+        } else if (op == ">") {
+          p->op = kGt;
+        } else if (op == ">=") {
+          p->op = kGe;
+        } else if (op == "~") {
+          p->op = kMatch;
+        } else {
+          error = "expected an operator after " + w;
+          break;
+        }
+        p->text = lexer.value();
+        if (p->text.empty()) {
+          error = "expected a value after " + w + " " + op;
+          break;
+        }
+      }
+      if (!query->compile_predicate(p, error)) {
+        break;
+      }
+    }
+  }
+
+  // Only hashes and arrays have a size in the dump, so a size predicate
+  // over other objects would quietly compare 0
+  bool uses_size = false, collections_only = false;
+  for (auto p : query->predicates) {
+    uses_size = uses_size || p->field == kSize;
+    if (p->field == kType && p->op == kEq && !p->negate && (p->number == RUBY_T_HASH || p->number == RUBY_T_ARRAY)) {
+      collections_only = true;
+    }
+  }
+  if (error.empty() && uses_size && !collections_only) {
+    error = "size only applies to hashes and arrays, so it needs type = HASH or type = ARRAY";
+  }
+
+  if (!error.empty()) {
+    delete query;
+    return NULL;
+  }
+
+  std::stable_sort(query->predicates.begin(), query->predicates.end(), [] (Predicate *a, Predicate *b) {
+    return get_cost(a->field, a->regex != NULL) < get_cost(b->field, b->regex != NULL);
+  });
+  return query;
+}
+
+bool Query::compile_predicate(Predicate *p, std::string &error) {
+  bool is_string = p->field == kType || p->field == kClass || p->field == kValue;
+  if (p->op == kMatch && p->field != kClass && p->field != kValue) {
+    error = std::string("~ only applies to class and value");
+    return false;
+  }
+  if (is_string && p->op != kEq && p->op != kNe && p->op != kMatch) {
+    error = std::string(get_field_name(p->field)) + " can only be compared with =, != or ~";
+    return false;
+  }
+  if (p->field == kRetained && !graph->has_dominator_tree()) {
+    error = "retained sizes are not available for a sampled heap";
+    return false;
+  }
+
+  if (p->field == kValue && p->op == kMatch && graph->get_value_bytes() && !graph->has_offsets()) {
+    error = "value ~ needs the whole of truncated values, which can't be read back from this dump; load it without --value-bytes";
+    return false;
+  }
+
+  if (p->op == kMatch) {
+    try {
+      p->regex = new std::regex(p->text, std::regex::extended | std::regex::optimize);
+    } catch (const std::regex_error &e) {
+      error = "invalid regex '" + p->text + "'";
+      return false;
+    }
+  }
+
+  if (p->field == kType) {
+    for (uint32_t t = 0; t <= RUBY_T_MASK; ++t) {
+      if (strcasecmp(p->text.c_str(), RubyHeapObj::get_value_type_string(t)) == 0) {
+        p->number = t;
+        return true;
+      }
+    }
+    error = "unknown type '" + p->text + "'";
+    return false;
+  } else if (p->field == kClass) {
+    // Resolved once to the class objects with a matching name, so testing
+    // an object is a set lookup
+    for (size_t i = 0; i < graph->get_num_nodes(); ++i) {
+      RubyHeapObj *obj = graph->get_node(i);
+      if (!obj || (obj->get_type() != RUBY_T_CLASS && obj->get_type() != RUBY_T_MODULE) || !obj->get_value()) {
+        continue;
+      }
+      bool match = p->regex ? std::regex_search(obj->get_value(), *p->regex) : p->text == obj->get_value();
+      if (match) {
+        p->classes.insert(obj);
+      }
+    }
+    // != and a failed match are the same test, negated
+    if (p->op == kNe) {
+      p->negate = !p->negate;
+    }
+    return true;
+  } else if (p->field == kValue) {
+    // Truncated values are interned by a hash of their whole contents, so
+    // one equal to text can only be this prefix
+    if (p->op != kMatch) {
+      p->prefix = graph->get_strings()->find_prefix(StringPool::hash(p->text.data(), p->text.size()));
+    }
+  } else {
+    char *end;
+    p->number = strtoull(p->text.c_str(), &end, 0);
+    if (*end) {
+      error = "expected a number, not '" + p->text + "'";
+      return false;
+    }
+  }
+  return true;
+}
+
+uint64_t Query::get_number(RubyHeapObj *obj, Field field) {
+  switch (field) {
+    case kType:
+      return obj->get_type();
+    case kMemsize:
+      return obj->get_memsize();
+    case kRetained:
+      return graph->get_retained_size(obj);
+    case kSize:
+      return obj->get_type() == RUBY_T_HASH || obj->get_type() == RUBY_T_ARRAY ? obj->get_size() : 0;
+    case kReferrers:
+      return obj->get_refs_from()->size();
+    case kAddr:
+      return obj->get_addr();
+    case kGeneration:
+      return obj->get_generation();
+    case kFrozen:
+      return (obj->get_flags() & RUBY_FL_FROZEN) != 0;
+    case kShared:
+      return (obj->get_flags() & RUBY_FL_SHARED) != 0;
+    default:
+      return 0;
+  }
+}
+
+bool Query::test(Predicate *p, RubyHeapObj *obj) {
+  if (p->field == kClass) {
+    return p->classes.find(obj->get_class_obj()) != p->classes.end();
+  }
+  if (p->field == kValue) {
+    // Only types that have a string value
+    RubyValueType type = obj->get_type();
+    const char *value = type == RUBY_T_STRING || type == RUBY_T_SYMBOL || type == RUBY_T_CLASS || type == RUBY_T_MODULE
+      ? obj->get_value() : NULL;
+    if (!value) {
+      return false;
+    }
+    if (obj->get_flags() & RUBY_FL_TRUNCATED) {
+      if (!p->regex) {
+        return (value == p->prefix) == (p->op == kEq);
+      }
+      std::string full;
+      return graph->get_full_value(obj, full) && std::regex_search(full, *p->regex);
+    }
+    if (p->regex) {
+      return std::regex_search(value, *p->regex);
+    }
+    return (p->text == value) == (p->op == kEq);
+  }
+
+  // Like top --older-than, objects allocated before tracing started have
+  // no generation to compare
+  if (p->field == kGeneration && !obj->has_generation()) {
+    return false;
+  }
+
+  uint64_t n = get_number(obj, p->field);
+  switch (p->op) {
+    case kEq: return n == p->number;
+    case kNe: return n != p->number;
+    case kLt: return n < p->number;
+    case kLe: return n <= p->number;
+    case kGt: return n > p->number;
+    case kGe: return n >= p->number;
+    default: return false;
+  }
+}
+
+bool Query::matches(RubyHeapObj *obj) {
+  for (auto p : predicates) {
+    if (test(p, obj) == p->negate) {
+      return false;
+    }
+  }
+  return true;
+}
+
+uintptr_t Query::get_group_key(RubyHeapObj *obj) {
+  return aggregate == kGroupByClass ? obj->get_class_key() : (uintptr_t) obj->get_type();
+}
+
+void Query::execute(Result &result) {
+  typedef google::sparse_hash_map<uintptr_t, Group> GroupMap;
+  struct Partial {
+    size_t count, memsize, sum;
+    std::vector<RubyHeapObj *> objects;
+    GroupMap groups;
+  };
+
+  size_t num_nodes = graph->get_num_nodes();
+  std::vector<Partial> partials(parallel_num_threads(num_nodes));
+  parallel_for(num_nodes, [&] (size_t begin, size_t end, size_t thread) {
+    Partial &partial = partials[thread];
+    partial.count = partial.memsize = partial.sum = 0;
+    for (size_t i = begin; i < end && !Cancellation::requested(); ++i) {
+      RubyHeapObj *obj = graph->get_node(i);
+      if (!obj || obj->is_root_object() || !matches(obj)) {
+        continue;
+      }
+      partial.count++;
+      partial.memsize += obj->get_memsize();
+      if (aggregate == kSum) {
+        partial.sum += get_number(obj, sum_field);
+      } else if (aggregate == kGroupByClass || aggregate == kGroupByType) {
+        uintptr_t key = get_group_key(obj);
+        auto it = partial.groups.find(key);
+        if (it == partial.groups.end()) {
+          Group g = { key, 0, 0, 0 };
+          it = partial.groups.insert(std::make_pair(key, g)).first;
+        }
+        it->second.count++;
+        it->second.memsize += obj->get_memsize();
+        it->second.sum += get_number(obj, sum_field);
+      } else if (aggregate == kList && partial.objects.size() < limit) {
+        partial.objects.push_back(obj);
+      }
+    }
+  });
+
+  // Chunks are contiguous, so listed objects stay in node order
+  GroupMap groups;
+  result.count = result.memsize = result.sum = 0;
+  result.objects.clear();
+  result.groups.clear();
+  for (auto &partial : partials) {
+    result.count += partial.count;
+    result.memsize += partial.memsize;
+    result.sum += partial.sum;
+    for (auto obj : partial.objects) {
+      if (result.objects.size() < limit) {
+        result.objects.push_back(obj);
+      }
+    }
+    for (auto it : partial.groups) {
+      auto g = groups.find(it.first);
+      if (g == groups.end()) {
+        groups.insert(it);
+      } else {
+        g->second.count += it.second.count;
+        g->second.memsize += it.second.memsize;
+        g->second.sum += it.second.sum;
+      }
+    }
+  }
+
+  for (auto it : groups) {
+    result.groups.push_back(it.second);
+  }
+  std::sort(result.groups.begin(), result.groups.end(), [] (const Group &a, const Group &b) {
+    return a.memsize > b.memsize;
+  });
+  if (result.groups.size() > limit) {
+    result.groups.resize(limit);
+  }
+}
+
+}
@@ -0,0 +1,104 @@
+#ifndef HARB_QUERY_H
+#define HARB_QUERY_H
+
+#include <unistd.h>
+
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "sparsehash/sparse_hash_set"
+
+#include "ruby_heap_obj.h"
+
+namespace harb {
+
+class Graph;
+
+// A `find` query: predicates over heap objects joined by "and", then an
+// optional aggregate and limit, e.g.
+//
+//   type = STRING and frozen and memsize > 1000 group by class limit 10
+//   class ~ ^ActiveRecord:: and referrers = 1 sum retained
+//   value ~ "^SELECT" and not shared count
+//
+// Fields: type, class, value, memsize, retained, size (or length; only
+// with type = HASH or type = ARRAY), referrers, addr, generation, and the
+// flags frozen and shared. Operators: = != < <= > >= and ~ (regex match,
+// for class and value). Aggregates: count, sum <field>, group by
+// class|type. Without one, matching objects are listed. Each predicate is
+// compiled to a closed form (class names are resolved to the matching
+// class objects, regexes are compiled once) and the predicates are ordered
+// cheapest first. Values truncated by --value-bytes are compared with = and
+// != by a hash of their whole contents, and read back from the dump to be
+// matched with ~.
+class Query {
+  public:
+    enum Field {
+      kType, kClass, kValue, kMemsize, kRetained, kSize, kReferrers, kAddr, kGeneration, kFrozen, kShared
+    };
+
+    enum Aggregate {
+      kList, kCount, kSum, kGroupByClass, kGroupByType
+    };
+
+    struct Group {
+      uintptr_t key; // class object, or type for objects without a named class
+      size_t count, memsize, sum;
+    };
+
+    struct Result {
+      size_t count, memsize, sum;
+      std::vector<RubyHeapObj *> objects; // kList, in node order
+      std::vector<Group> groups; // largest memsize first
+    };
+
+    ~Query();
+
+    // Returns NULL and sets error if text can't be parsed
+    static Query * compile(Graph *graph, const std::string &text, std::string &error);
+
+    bool matches(RubyHeapObj *obj);
+
+    // Runs the query over the node table in parallel chunks
+    void execute(Result &result);
+
+    Aggregate get_aggregate() { return aggregate; }
+
+    Field get_sum_field() { return sum_field; }
+
+    size_t get_limit() { return limit; }
+
+    static const char * get_field_name(Field field);
+
+  private:
+    enum Op { kEq, kNe, kLt, kLe, kGt, kGe, kMatch };
+
+    struct Predicate {
+      Field field;
+      Op op;
+      uint64_t number;
+      std::string text;
+      std::regex *regex;
+      const char *prefix; // for kValue: how a truncated value equal to text is kept
+      bool negate;
+      google::sparse_hash_set<RubyHeapObj *> classes; // for kClass
+    };
+
+    Graph *graph;
+    std::vector<Predicate *> predicates;
+    Aggregate aggregate;
+    Field sum_field;
+    size_t limit;
+
+    Query(Graph *graph) : graph(graph), aggregate(kList), sum_field(kMemsize), limit(20) {}
+
+    uint64_t get_number(RubyHeapObj *obj, Field field);
+    bool test(Predicate *p, RubyHeapObj *obj);
+    bool compile_predicate(Predicate *p, std::string &error);
+    uintptr_t get_group_key(RubyHeapObj *obj);
+};
+
+}
+
+#endif // HARB_QUERY_H
@@ -0,0 +1,150 @@
+#include <string.h>
+
+#include "cancellation.h"
+#include "graph.h"
+#include "parallel.h"
+#include "reachable.h"
+
+namespace harb {
+
+// Heuristics from Beamer et al.: go bottom-up once the frontier's edges
+// exceed 1/kAlpha of the unexplored edges, and back to top-down once the
+// frontier shrinks below 1/kBeta of the nodes.
+static const size_t kAlpha = 14;
+static const size_t kBeta = 24;
+
+ReachableSet::ReachableSet(Graph *graph)
+  : graph(graph), num_nodes(graph->get_num_nodes()), num_words((num_nodes + 63) / 64), count(0) {
+  visited = new std::atomic<uint64_t>[num_words]();
+  frontier_bits = NULL;
+}
+
+ReachableSet::~ReachableSet() {
+  delete[] visited;
+  delete[] frontier_bits;
+}
+
+size_t ReachableSet::count_edges(RubyHeapObj *obj) {
+  size_t n = 0;
+  if (obj->has_refs_to()) {
+    while (obj->get_refs_to(n)) {
+      n++;
+    }
+  }
+  return n;
+}
+
+// Returns the number of edges out of the new frontier
+size_t ReachableSet::top_down_step(std::vector<uint32_t> &frontier, std::vector<uint32_t> &next) {
+  std::vector<std::vector<uint32_t>> thread_next(parallel_num_threads(frontier.size()));
+  std::vector<size_t> thread_edges(thread_next.size(), 0);
+
+  parallel_for(frontier.size(), [&] (size_t begin, size_t end, size_t thread) {
+    std::vector<uint32_t> &out = thread_next[thread];
+    for (size_t i = begin; i < end; ++i) {
+      RubyHeapObj *obj = graph->get_node(frontier[i]);
+      if (!obj->has_refs_to()) {
+        continue;
+      }
+      for (uint32_t j = 0; obj->get_refs_to(j); ++j) {
+        RubyHeapObj *ref = obj->get_refs_to(j);
+        if (test_and_set(visited, ref->get_index())) {
+          out.push_back(ref->get_index());
+          thread_edges[thread] += count_edges(ref);
+        }
+      }
+    }
+  });
+
+  size_t edges = 0;
+  next.clear();
+  for (size_t t = 0; t < thread_next.size(); ++t) {
+    next.insert(next.end(), thread_next[t].begin(), thread_next[t].end());
+    edges += thread_edges[t];
+  }
+  return edges;
+}
+
+size_t ReachableSet::bottom_up_step(std::vector<uint32_t> &frontier, std::vector<uint32_t> &next) {
+  if (!frontier_bits) {
+    frontier_bits = new std::atomic<uint64_t>[num_words]();
+  } else {
+    for (size_t i = 0; i < num_words; ++i) {
+      frontier_bits[i].store(0, std::memory_order_relaxed);
+    }
+  }
+  for (auto idx : frontier) {
+    frontier_bits[idx >> 6].fetch_or(1ULL << (idx & 63), std::memory_order_relaxed);
+  }
+
+  std::vector<std::vector<uint32_t>> thread_next(parallel_num_threads(num_nodes));
+  std::vector<size_t> thread_edges(thread_next.size(), 0);
+
+  parallel_for(num_nodes, [&] (size_t begin, size_t end, size_t thread) {
+    std::vector<uint32_t> &out = thread_next[thread];
+    for (size_t i = begin; i < end; ++i) {
+      RubyHeapObj *obj = graph->get_node(i);
+      if (!obj || test(visited, i)) {
+        continue;
+      }
+      for (auto ref : *obj->get_refs_from()) {
+        if (test(frontier_bits, ref->get_index())) {
+          test_and_set(visited, i);
+          out.push_back(i);
+          thread_edges[thread] += count_edges(obj);
+          break;
+        }
+      }
+    }
+  });
+
+  size_t edges = 0;
+  next.clear();
+  for (size_t t = 0; t < thread_next.size(); ++t) {
+    next.insert(next.end(), thread_next[t].begin(), thread_next[t].end());
+    edges += thread_edges[t];
+  }
+  return edges;
+}
+
+void ReachableSet::calculate(RubyHeapObj *start) {
+  for (size_t i = 0; i < num_words; ++i) {
+    visited[i].store(0, std::memory_order_relaxed);
+  }
+
+  std::vector<size_t> thread_edges(parallel_num_threads(num_nodes), 0);
+  parallel_for(num_nodes, [&] (size_t begin, size_t end, size_t thread) {
+    for (size_t i = begin; i < end; ++i) {
+      RubyHeapObj *obj = graph->get_node(i);
+      if (obj && !obj->is_root_object()) {
+        thread_edges[thread] += count_edges(obj);
+      }
+    }
+  });
+  size_t unexplored_edges = 0;
+  for (auto e : thread_edges) {
+    unexplored_edges += e;
+  }
+
+  std::vector<uint32_t> frontier, next;
+  frontier.push_back(start->get_index());
+  test_and_set(visited, start->get_index());
+  count = 1;
+
+  size_t frontier_edges = count_edges(start);
+  bool bottom_up = false;
+  while (!frontier.empty() && !Cancellation::requested()) {
+    unexplored_edges -= std::min(unexplored_edges, frontier_edges);
+    if (!bottom_up && frontier_edges > unexplored_edges / kAlpha) {
+      bottom_up = true;
+    } else if (bottom_up && frontier.size() < num_nodes / kBeta) {
+      bottom_up = false;
+    }
+
+    frontier_edges = bottom_up ? bottom_up_step(frontier, next) : top_down_step(frontier, next);
+    count += next.size();
+    frontier.swap(next);
+  }
+}
+
+}
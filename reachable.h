@@ -0,0 +1,62 @@
+#ifndef HARB_REACHABLE_H
+#define HARB_REACHABLE_H
+
+#include <unistd.h>
+
+#include <atomic>
+#include <vector>
+
+#include "ruby_heap_obj.h"
+
+namespace harb {
+
+class Graph;
+
+// The set of objects reachable from a starting object over refs_to,
+// found with a parallel, direction-optimizing BFS (Beamer et al.): levels
+// with small frontiers are expanded top-down from the frontier, and levels
+// whose frontier covers much of the remaining graph are expanded bottom-up,
+// with each unvisited object scanning its refs_from for a frontier parent.
+// Visited objects are kept in a bitmap indexed by node index.
+class ReachableSet {
+  public:
+    ReachableSet(Graph *graph);
+    ~ReachableSet();
+
+    void calculate(RubyHeapObj *start);
+
+    bool contains(RubyHeapObj *obj) {
+      return test(visited, obj->get_index());
+    }
+
+    size_t get_count() { return count; }
+
+  private:
+    Graph *graph;
+    size_t num_nodes;
+    size_t num_words;
+    size_t count;
+    std::atomic<uint64_t> *visited;
+    std::atomic<uint64_t> *frontier_bits;
+
+    static bool test(std::atomic<uint64_t> *bits, size_t i) {
+      return bits[i >> 6].load(std::memory_order_relaxed) & (1ULL << (i & 63));
+    }
+
+    // Returns true if the bit was newly set
+    static bool test_and_set(std::atomic<uint64_t> *bits, size_t i) {
+      uint64_t bit = 1ULL << (i & 63);
+      if (bits[i >> 6].load(std::memory_order_relaxed) & bit) {
+        return false;
+      }
+      return !(bits[i >> 6].fetch_or(bit, std::memory_order_relaxed) & bit);
+    }
+
+    size_t count_edges(RubyHeapObj *obj);
+    size_t top_down_step(std::vector<uint32_t> &frontier, std::vector<uint32_t> &next);
+    size_t bottom_up_step(std::vector<uint32_t> &frontier, std::vector<uint32_t> &next);
+};
+
+}
+
+#endif // HARB_REACHABLE_H
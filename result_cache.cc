@@ -0,0 +1,70 @@
+#include "result_cache.h"
+
+namespace harb {
+
+// Per entry overhead of the list node, hash node and key
+static const size_t kEntryOverhead = 128;
+
+std::string ResultCache::make_key(const char *command, RubyHeapObj *obj, const std::string &options) {
+  // Objects are keyed by pointer rather than index, since several dumps can
+  // be loaded and each numbers its objects from 1
+  std::string key(command);
+  key += '\0';
+  key.append((const char *) &obj, sizeof(obj));
+  key += options;
+  return key;
+}
+
+std::shared_ptr<ResultCache::Entry> ResultCache::get(const char *command, RubyHeapObj *obj, const std::string &options) {
+  auto it = entries.find(make_key(command, obj, options));
+  if (it == entries.end()) {
+    misses++;
+    return NULL;
+  }
+  hits++;
+  lru.splice(lru.begin(), lru, it->second);
+  return it->second->second;
+}
+
+void ResultCache::put(const char *command, RubyHeapObj *obj, const std::string &options, std::shared_ptr<Entry> entry) {
+  std::string key = make_key(command, obj, options);
+  size_t entry_bytes = entry->get_bytes() + key.size() + kEntryOverhead;
+  if (entry_bytes > max_bytes) {
+    return;
+  }
+
+  auto it = entries.find(key);
+  if (it != entries.end()) {
+    bytes -= it->second->second->get_bytes() + key.size() + kEntryOverhead;
+    lru.erase(it->second);
+    entries.erase(it);
+  }
+
+  evict(max_bytes - entry_bytes);
+  lru.push_front(std::make_pair(key, entry));
+  entries[key] = lru.begin();
+  bytes += entry_bytes;
+}
+
+void ResultCache::evict(size_t max) {
+  while (bytes > max && !lru.empty()) {
+    auto &last = lru.back();
+    bytes -= last.second->get_bytes() + last.first.size() + kEntryOverhead;
+    entries.erase(last.first);
+    lru.pop_back();
+    evictions++;
+  }
+}
+
+void ResultCache::clear() {
+  lru.clear();
+  entries.clear();
+  bytes = 0;
+}
+
+void ResultCache::set_max_bytes(size_t max) {
+  max_bytes = max;
+  evict(max_bytes);
+}
+
+}
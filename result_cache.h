@@ -0,0 +1,78 @@
+#ifndef HARB_RESULT_CACHE_H
+#define HARB_RESULT_CACHE_H
+
+#include <unistd.h>
+
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "ruby_heap_obj.h"
+
+namespace harb {
+
+// Results of expensive per-object commands (root paths, reachable sets,
+// subtree aggregates), kept so asking again about the same object only
+// costs printing them. Entries are keyed by command, object and options,
+// and the least recently used are evicted once their estimated size passes
+// the limit. Loaded graphs never change, so entries never go stale.
+class ResultCache {
+  public:
+    class Entry {
+      public:
+        virtual ~Entry() {}
+        // Estimated memory use, for the cache's accounting
+        virtual size_t get_bytes() = 0;
+    };
+
+    // An entry holding any value, with its size estimated by the caller
+    template<typename T> class Value : public Entry {
+      public:
+        T value;
+        size_t bytes;
+
+        Value() : bytes(sizeof(*this)) {}
+        size_t get_bytes() { return bytes; }
+    };
+
+    ResultCache(size_t max_bytes) : max_bytes(max_bytes), bytes(0), hits(0), misses(0), evictions(0) {}
+    ~ResultCache() { clear(); }
+
+    // The cached result, or NULL
+    std::shared_ptr<Entry> get(const char *command, RubyHeapObj *obj, const std::string &options = "");
+
+    template<typename T> std::shared_ptr<T> get(const char *command, RubyHeapObj *obj, const std::string &options = "") {
+      return std::static_pointer_cast<T>(get(command, obj, options));
+    }
+
+    // Entries larger than the whole cache aren't kept
+    void put(const char *command, RubyHeapObj *obj, const std::string &options, std::shared_ptr<Entry> entry);
+
+    void clear();
+
+    void set_max_bytes(size_t max);
+
+    size_t get_max_bytes() { return max_bytes; }
+    size_t get_bytes() { return bytes; }
+    size_t get_num_entries() { return entries.size(); }
+    size_t get_hits() { return hits; }
+    size_t get_misses() { return misses; }
+    size_t get_evictions() { return evictions; }
+
+  private:
+    typedef std::list<std::pair<std::string, std::shared_ptr<Entry>>> EntryList;
+
+    size_t max_bytes;
+    size_t bytes;
+    size_t hits, misses, evictions;
+    EntryList lru; // most recently used first
+    std::unordered_map<std::string, EntryList::iterator> entries;
+
+    static std::string make_key(const char *command, RubyHeapObj *obj, const std::string &options);
+    void evict(size_t max);
+};
+
+}
+
+#endif // HARB_RESULT_CACHE_H
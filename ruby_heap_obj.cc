@@ -1,6 +1,9 @@
 #include <inttypes.h>
 
+#include <string>
+
 #include "ruby_heap_obj.h"
+#include "cancellation.h"
 #include "graph.h"
 
 namespace harb {
@@ -8,7 +11,12 @@ namespace harb {
 RubyHeapObj::RubyHeapObj(Graph *graph, RubyValueType t, int32_t idx)
   : flags(t), idx(idx), graph(graph) {
   refs_to.addr = NULL;
+  as.obj.addr = 0;
   as.obj.clazz.addr = 0;
+  as.obj.memsize = 0;
+  as.obj.as.value = NULL;
+  as.obj.alloc_site = 0;
+  as.obj.generation = RUBY_GENERATION_UNKNOWN;
 
   if (t == RUBY_T_ROOT) {
     as.root.children = new RubyHeapObjList();
@@ -135,6 +143,15 @@ const char * RubyHeapObj::get_value_type_string(uint32_t type) {
   return "NONE";
 }
 
+uintptr_t RubyHeapObj::get_class_key() {
+  RubyHeapObj *clazz = get_class_obj();
+  return clazz && clazz->get_value() ? (uintptr_t) clazz : (uintptr_t) get_type();
+}
+
+const char * RubyHeapObj::get_class_key_label(uintptr_t key) {
+  return key <= RUBY_T_MASK ? get_value_type_string(key) : ((RubyHeapObj *) key)->get_value();
+}
+
 const char * RubyHeapObj::get_object_summary(char *buf, size_t buf_sz) {
   uint32_t type = flags & RUBY_T_MASK;
   if (type == RUBY_T_ROOT) {
@@ -146,15 +163,17 @@ const char * RubyHeapObj::get_object_summary(char *buf, size_t buf_sz) {
   if (type == RUBY_T_ARRAY || type == RUBY_T_HASH) {
     sprintf(value_buf, "size %d", get_size());
   } else if (type == RUBY_T_OBJECT || type == RUBY_T_ICLASS) {
-    value_bufp = get_class_obj()->get_value();
+    value_bufp = get_class_obj() ? get_class_obj()->get_value() : NULL;
   } else if (type == RUBY_T_STRING && flags & RUBY_FL_SHARED) {
-    value_bufp = get_refs_to(0)->get_value();
+    // The shared string may not have been loaded when sampling
+    value_bufp = has_refs_to() && get_refs_to(0) ? get_refs_to(0)->get_value() : NULL;
   } else {
     value_bufp = get_value();
   }
-  int ret = snprintf(buf, buf_sz, "%s: %s%s%s", get_value_type_string(flags),
+  int ret = snprintf(buf, buf_sz, "%s: %s%s%s%s", get_value_type_string(flags),
     type == RUBY_T_STRING ? "\"" : "",
     value_bufp,
+    flags & RUBY_FL_TRUNCATED ? "..." : "",
     type == RUBY_T_STRING ? "\"" : "");
   if (ret < 0) {
     return NULL;
@@ -184,6 +203,7 @@ void RubyHeapObj::print_object(FILE *out) {
     char buf[64] = { 0 };
     const char *p = buf;
     const char *name_title = NULL;
+    std::string full_value;
     sprintf(buf, "0x%" PRIx64, get_addr());
     fprintf(out, "%18s: \"%s\"\n", buf, get_value_type_string(flags));
     if (type == RUBY_T_DATA) {
@@ -191,10 +211,17 @@ void RubyHeapObj::print_object(FILE *out) {
       p = get_value();
     } else if (type == RUBY_T_OBJECT || type == RUBY_T_ICLASS) {
       name_title = type == RUBY_T_OBJECT ? "class" : "name";
-      p = get_class_obj()->get_value();
+      p = get_class_obj() ? get_class_obj()->get_value() : NULL;
     } else if (type == RUBY_T_STRING || type == RUBY_T_SYMBOL) {
       name_title = "value";
       p = get_value();
+      if (flags & RUBY_FL_TRUNCATED) {
+        // Only a prefix was kept, so read the rest back from the dump
+        if (!graph->get_full_value(this, full_value)) {
+          full_value = std::string(p) + "...";
+        }
+        p = full_value.c_str();
+      }
     } else if (type == RUBY_T_CLASS || type == RUBY_T_MODULE) {
       name_title = "name";
       p = get_value();
@@ -215,7 +242,9 @@ void RubyHeapObj::print_object(FILE *out) {
 
     fprintf(out, "%18s: %'zu\n", "memsize", get_memsize());
 
-    fprintf(out, "%18s: %'zu\n", "retained memsize", graph->get_retained_size(this));
+    if (graph->has_dominator_tree()) {
+      fprintf(out, "%18s: %'zu\n", "retained memsize", graph->get_retained_size(this));
+    }
 
     if (flags & RUBY_FL_SHARED) {
       fprintf(out, "%18s: %s\n", "shared", "true");
@@ -225,16 +254,43 @@ void RubyHeapObj::print_object(FILE *out) {
       fprintf(out, "%18s: %s\n", "frozen", "true");
     }
 
+    if (flags & (RUBY_FL_GC_OLD | RUBY_FL_GC_MARKED | RUBY_FL_GC_WB_PROTECTED | RUBY_FL_GC_UNCOLLECTIBLE)) {
+      fprintf(out, "%18s:%s%s%s%s\n", "gc flags",
+        flags & RUBY_FL_GC_OLD ? " old" : "",
+        flags & RUBY_FL_GC_MARKED ? " marked" : "",
+        flags & RUBY_FL_GC_WB_PROTECTED ? " wb_protected" : "",
+        flags & RUBY_FL_GC_UNCOLLECTIBLE ? " uncollectible" : "");
+    }
+
+    uint32_t component = graph->get_components()->get_component(this);
+    if (component) {
+      const StronglyConnectedComponents::Component &c = graph->get_components()->get_component_info(component);
+      fprintf(out, "%18s: #%u (%'u objects, %'zu bytes)\n", "cycle", component, c.size, c.memsize);
+    }
+
+    if (has_generation()) {
+      fprintf(out, "%18s: %u\n", "generation", get_generation());
+    }
+
+    if (as.obj.alloc_site) {
+      const AllocSite &site = graph->get_alloc_site(as.obj.alloc_site);
+      fprintf(out, "%18s: %s:%u", "allocated at", site.file ? site.file : "?", site.line);
+      if (site.method) {
+        fprintf(out, " (%s)", site.method);
+      }
+      fprintf(out, "\n");
+    }
+
     if (has_refs_to()) {
       fprintf(out, "%18s: [\n", "references to");
-      for (uint32_t i = 0; refs_to.obj[i]; ++i) {
+      for (uint32_t i = 0; refs_to.obj[i] && !Cancellation::requested(); ++i) {
         refs_to.obj[i]->print_ref_object(out);
       }
       fprintf(out, "%18s  ]\n", "");
     }
     if (refs_from.size() > 0) {
       fprintf(out, "%18s: [\n", "referenced from");
-      for (auto it = refs_from.begin(); it != refs_from.end(); ++it) {
+      for (auto it = refs_from.begin(); it != refs_from.end() && !Cancellation::requested(); ++it) {
         (*it)->print_ref_object(out);
       }
       fprintf(out, "%18s  ]\n", "");
@@ -1,6 +1,10 @@
 #ifndef HARB_RUBY_HEAP_OBJ_H
 #define HARB_RUBY_HEAP_OBJ_H
 
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
 #include <unistd.h>
 
 #include <vector>
@@ -51,9 +55,19 @@ enum RubyFlagType {
     RUBY_FL_GC_WB_PROTECTED = 0x100,
     RUBY_FL_GC_OLD          = 0x200,
     RUBY_FL_GC_MARKED       = 0x400,
-    RUBY_FL_SHARED          = 0x800
+    RUBY_FL_SHARED          = 0x800,
+    RUBY_FL_GC_UNCOLLECTIBLE = 0x1000,
+    RUBY_FL_TRUNCATED       = 0x2000  // only a prefix of the value was kept
 };
 
+// The bits of an object's flags above the RubyFlagType ones hold the size of
+// its heap slot, which dumps from Ruby 3.2 on include. 0 means unknown.
+#define RUBY_SLOT_SIZE_SHIFT 16
+#define RUBY_SLOT_SIZE_MAX (UINT32_MAX >> RUBY_SLOT_SIZE_SHIFT)
+
+// Generation of objects in dumps taken without allocation tracing
+#define RUBY_GENERATION_UNKNOWN UINT32_MAX
+
 class RubyHeapObj;
 class Graph;
 class Parser;
@@ -61,6 +75,14 @@ class Parser;
 typedef std::vector<RubyHeapObj *> RubyHeapObjList;
 typedef std::vector<uint64_t> RubyHeapAddrList;
 
+// Where an object was allocated, from dumps taken with allocation tracing
+// enabled. Objects refer to these by id; id 0 means unknown.
+struct AllocSite {
+  const char *file;
+  uint32_t line;
+  const char *method;
+};
+
 class RubyHeapObj {
 private:
   friend class Graph;
@@ -89,6 +111,8 @@ private:
       const char *value;
       uint32_t size;
     } as;
+    uint32_t alloc_site;
+    uint32_t generation; // GC count when the object was allocated
   } obj;
   struct {
     const char *name;
@@ -101,28 +125,53 @@ public:
 
   bool is_root_object() { return (flags & RUBY_T_MASK) == RUBY_T_ROOT; }
 
-  uint32_t get_flags() { return flags; }
+  uint32_t get_flags() { return flags & ((1U << RUBY_SLOT_SIZE_SHIFT) - 1); }
+
+  // The size of the object's heap slot, or 0 if the dump doesn't record it
+  uint32_t get_slot_size() { return flags >> RUBY_SLOT_SIZE_SHIFT; }
 
   uint32_t get_index() { return idx; }
 
+  Graph * get_graph() { return graph; }
+
   RubyValueType get_type() { return (RubyValueType) (flags & RUBY_T_MASK); }
 
   bool has_refs_to() { return refs_to.obj != NULL; }
 
   RubyHeapObj * get_refs_to(size_t index) { return refs_to.obj[index]; }
 
+  // The NULL terminated array of referenced objects, or NULL if there are none
+  RubyHeapObj * const * get_refs_to_array() { return refs_to.obj; }
+
   const RubyHeapObjList * get_refs_from() { return &refs_from; }
 
   uint64_t get_addr() { return as.obj.addr; }
 
   RubyHeapObj * get_class_obj() { return as.obj.clazz.obj; }
 
+  // Only valid before references are resolved (e.g. in streaming parses)
+  uint64_t get_class_addr() { return as.obj.clazz.addr; }
+
   size_t get_memsize() { return as.obj.memsize; }
 
   const char * get_value() { return as.obj.as.value; }
 
   uint32_t get_size() { return as.obj.as.size; }
 
+  uint32_t get_alloc_site() { return as.obj.alloc_site; }
+
+  uint32_t get_generation() { return as.obj.generation; }
+
+  bool has_generation() { return as.obj.generation != RUBY_GENERATION_UNKNOWN; }
+
+  bool is_old() { return (flags & RUBY_FL_GC_OLD) != 0; }
+
+  // Groups objects by class for classgraph, contents and find: the class
+  // object for named classes, or the type for objects whose class has no
+  // name (such as the singleton classes of classes). Types are small
+  // integers, so they can't be confused with a class object's address.
+  uintptr_t get_class_key();
+
   const char * get_root_name() { return as.root.name; }
 
   const RubyHeapObjList * get_root_children() { return as.root.children; }
@@ -135,6 +184,9 @@ public:
 
   static RubyValueType get_value_type(const char *str);
   static const char * get_value_type_string(uint32_t type);
+
+  // A get_class_key() key's class name, or type name
+  static const char * get_class_key_label(uintptr_t key);
 };
 
 }
@@ -0,0 +1,115 @@
+#include "progress.h"
+#include "scc.h"
+
+namespace harb {
+
+// Marks objects that are on the Tarjan stack. Once an object's component is
+// found it gets the component's id, or 0 if it isn't a cycle.
+static const uint32_t kPending = UINT32_MAX;
+
+StronglyConnectedComponents::StronglyConnectedComponents(const RubyHeapObjList &nodes)
+  : nodes(nodes), num_nodes(nodes.size()), index(NULL), lowlink(NULL) {
+  component = new uint32_t[num_nodes]();
+  Component none = { 0, 0 };
+  components.push_back(none);
+}
+
+StronglyConnectedComponents::~StronglyConnectedComponents() {
+  delete[] component;
+}
+
+RubyHeapObj * StronglyConnectedComponents::get_child(RubyHeapObj *obj, uint32_t i) {
+  if (obj->get_type() == RUBY_T_ROOT && obj->get_root_children()) {
+    auto children = obj->get_root_children();
+    return i < children->size() ? (*children)[i] : NULL;
+  }
+  return obj->has_refs_to() ? obj->get_refs_to(i) : NULL;
+}
+
+void StronglyConnectedComponents::pop_component(uint32_t node, std::vector<uint32_t> &stack) {
+  size_t first = stack.size();
+  do {
+    first--;
+  } while (stack[first] != node);
+
+  uint32_t id = 0;
+  if (stack.size() - first > 1) {
+    Component c = { 0, 0 };
+    id = components.size();
+    components.push_back(c);
+  }
+
+  Component &c = components[id];
+  for (size_t i = first; i < stack.size(); ++i) {
+    component[stack[i]] = id;
+    if (id) {
+      c.size++;
+      c.memsize += nodes[stack[i]]->is_root_object() ? 0 : nodes[stack[i]]->get_memsize();
+    }
+  }
+  stack.resize(first);
+}
+
+void StronglyConnectedComponents::calculate() {
+  Progress progress("finding reference cycles", num_nodes);
+  progress.start();
+
+  index = new uint32_t[num_nodes]();
+  lowlink = new uint32_t[num_nodes];
+
+  std::vector<uint32_t> stack;
+  std::vector<Frame> frames;
+  uint32_t next_index = 0;
+
+  for (uint32_t start = 1; start < num_nodes; ++start) {
+    if (!nodes[start] || index[start]) {
+      continue;
+    }
+
+    Frame f = { start, 0 };
+    frames.push_back(f);
+    index[start] = lowlink[start] = ++next_index;
+    component[start] = kPending;
+    stack.push_back(start);
+    progress.increment();
+
+    while (!frames.empty()) {
+      Frame &top = frames.back();
+      uint32_t v = top.node;
+      RubyHeapObj *child = get_child(nodes[v], top.edge++);
+
+      if (child) {
+        uint32_t w = child->get_index();
+        if (!index[w]) {
+          index[w] = lowlink[w] = ++next_index;
+          component[w] = kPending;
+          stack.push_back(w);
+          progress.increment();
+          Frame next = { w, 0 };
+          frames.push_back(next);
+        } else if (component[w] == kPending) {
+          lowlink[v] = std::min(lowlink[v], index[w]);
+        }
+        continue;
+      }
+
+      if (lowlink[v] == index[v]) {
+        pop_component(v, stack);
+      }
+      frames.pop_back();
+      if (!frames.empty()) {
+        uint32_t parent = frames.back().node;
+        lowlink[parent] = std::min(lowlink[parent], lowlink[v]);
+      }
+    }
+  }
+
+  delete[] index;
+  delete[] lowlink;
+  index = lowlink = NULL;
+
+  progress.set_items(next_index);
+  progress.complete();
+}
+
+}
@@ -0,0 +1,55 @@
+#ifndef HARB_SCC_H
+#define HARB_SCC_H
+
+#include <unistd.h>
+
+#include <vector>
+
+#include "ruby_heap_obj.h"
+
+namespace harb {
+
+// Strongly connected components of the refs_to graph, found with an
+// iterative version of Tarjan's algorithm so that long reference chains
+// can't overflow the stack. Only components with more than one object (the
+// reference cycles) are numbered; every other object is in component 0.
+class StronglyConnectedComponents {
+  public:
+    struct Component {
+      uint32_t size;
+      size_t memsize;
+    };
+
+    // nodes is indexed by RubyHeapObj::get_index()
+    StronglyConnectedComponents(const RubyHeapObjList &nodes);
+    ~StronglyConnectedComponents();
+
+    void calculate();
+
+    uint32_t get_component(RubyHeapObj *obj) { return component[obj->get_index()]; }
+
+    // Components are numbered from 1
+    size_t get_num_components() { return components.size() - 1; }
+
+    const Component & get_component_info(uint32_t id) { return components[id]; }
+
+  private:
+    struct Frame {
+      uint32_t node;
+      uint32_t edge;
+    };
+
+    const RubyHeapObjList &nodes;
+    uint32_t num_nodes;
+    uint32_t *component;
+    uint32_t *index;
+    uint32_t *lowlink;
+    std::vector<Component> components;
+
+    RubyHeapObj * get_child(RubyHeapObj *obj, uint32_t i);
+    void pop_component(uint32_t node, std::vector<uint32_t> &stack);
+};
+
+}
+
+#endif // HARB_SCC_H
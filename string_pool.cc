@@ -0,0 +1,67 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "string_pool.h"
+
+namespace harb {
+
+StringPool::~StringPool() {
+  for (auto str : strings_) {
+    free((void *) str);
+  }
+  for (auto it : prefixes_) {
+    free((void *) it.second);
+  }
+}
+
+// FNV-1a
+uint64_t StringPool::hash(const char *str, size_t length) {
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < length; ++i) {
+    h = (h ^ (unsigned char) str[i]) * 1099511628211ULL;
+  }
+  return h;
+}
+
+const char * StringPool::intern(const char *str) {
+  assert(str);
+  auto it = strings_.find(str);
+  if (it != strings_.end()) {
+    return *it;
+  }
+  const char *dup = strdup(str);
+  strings_.insert(dup);
+  bytes_ += strlen(dup) + 1;
+  return dup;
+}
+
+const char * StringPool::intern_prefix(const char *str, size_t length, size_t max_bytes) {
+  assert(str && length > max_bytes);
+  uint64_t h = hash(str, length);
+  auto it = prefixes_.find(h);
+  if (it != prefixes_.end()) {
+    return it->second;
+  }
+  while (max_bytes > 0 && ((unsigned char) str[max_bytes] & 0xc0) == 0x80) {
+    --max_bytes;
+  }
+  const char *dup = strndup(str, max_bytes);
+  prefixes_[h] = dup;
+  bytes_ += max_bytes + 1;
+  return dup;
+}
+
+const char * StringPool::intern_prefix(const char *prefix, uint64_t hash) {
+  assert(prefix);
+  auto it = prefixes_.find(hash);
+  if (it != prefixes_.end()) {
+    return it->second;
+  }
+  const char *dup = strdup(prefix);
+  prefixes_[hash] = dup;
+  bytes_ += strlen(dup) + 1;
+  return dup;
+}
+
+}
@@ -0,0 +1,78 @@
+#ifndef HARB_STRING_POOL_H
+#define HARB_STRING_POOL_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "sparsehash/sparse_hash_map"
+#include "sparsehash/sparse_hash_set"
+
+namespace harb {
+
+// Interned strings (values, class names, root names, allocation sites).
+// Each distinct string is stored once, so interned strings can be compared
+// by pointer. A pool can be shared by several graphs, in which case a
+// second dump only adds the strings the first one didn't have, and equal
+// strings are the same pointer across graphs.
+class StringPool {
+  struct eqstr {
+    bool operator()(const char* s1, const char* s2) const {
+      return (s1 == s2) || (s1 && s2 && strcmp(s1, s2) == 0);
+    }
+  };
+
+  // FNV-1a over the string contents (std::hash<const char *> hashes the pointer)
+  struct hashstr {
+    size_t operator()(const char *s) const {
+      return s ? hash(s, strlen(s)) : 0;
+    }
+  };
+
+  typedef google::sparse_hash_set<const char *, hashstr, eqstr> StringSet;
+  typedef google::sparse_hash_map<uint64_t, const char *> PrefixMap;
+
+  StringSet strings_;
+  // Truncated values by a hash of their full contents
+  PrefixMap prefixes_;
+  size_t bytes_;
+
+public:
+  StringPool() : bytes_(0) {}
+  ~StringPool();
+
+  const char * intern(const char *str);
+
+  // Keeps only the first max_bytes of str (cut back to a whole UTF-8
+  // character). Equal strings still get the same pointer, because prefixes
+  // are looked up by a 64-bit hash of the whole string, and the prefix of a
+  // long string is never the same pointer as an equal short string.
+  const char * intern_prefix(const char *str, size_t length, size_t max_bytes);
+
+  // The prefix of a string whose whole contents hash to hash, as kept by
+  // intern_prefix, e.g. when restoring a checkpoint
+  const char * intern_prefix(const char *prefix, uint64_t hash);
+
+  // The prefix kept for a truncated string whose whole contents hash to
+  // hash, or NULL if no such string was interned
+  const char * find_prefix(uint64_t hash) {
+    auto it = prefixes_.find(hash);
+    return it != prefixes_.end() ? it->second : NULL;
+  }
+
+  // Calls func(hash, prefix) for each truncated value
+  template<typename Func> void each_prefix(Func func) {
+    for (auto it : prefixes_) {
+      func(it.first, it.second);
+    }
+  }
+
+  static uint64_t hash(const char *str, size_t length);
+
+  size_t size() { return strings_.size() + prefixes_.size(); }
+
+  size_t get_bytes() { return bytes_; }
+};
+
+}
+
+#endif // HARB_STRING_POOL_H
@@ -0,0 +1,240 @@
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "input_stream.h"
+#include "parallel.h"
+#include "parser.h"
+#include "progress.h"
+#include "summary.h"
+
+namespace harb {
+
+// Ranges smaller than this aren't worth a thread of their own
+static const uint64_t kMinRangeSize = 16 << 20;
+
+HeapSummary::HeapSummary() : total_count_(0), total_memsize_(0), strings_pruned_(false) {
+  memset(type_stats_, 0, sizeof(type_stats_));
+}
+
+void HeapSummary::add(RubyHeapObj *obj) {
+  if (obj->is_root_object()) {
+    return;
+  }
+
+  uint32_t type = obj->get_type();
+  size_t memsize = obj->get_memsize();
+
+  total_count_++;
+  total_memsize_ += memsize;
+  type_stats_[type].count++;
+  type_stats_[type].memsize += memsize;
+
+  if (obj->get_class_addr()) {
+    Stats &s = class_stats_[obj->get_class_addr()];
+    s.count++;
+    s.memsize += memsize;
+  }
+
+  if ((type == RUBY_T_CLASS || type == RUBY_T_MODULE) && obj->get_value()) {
+    class_names_[obj->get_addr()] = obj->get_value();
+  } else if (type == RUBY_T_STRING && obj->get_value()) {
+    const char *value = obj->get_value();
+    add_string(std::string(value, strnlen(value, kMaxStringKeyLength)), 1, memsize);
+  }
+}
+
+void HeapSummary::add_string(const std::string &value, size_t count, size_t memsize) {
+  auto it = strings_.find(value);
+  if (it != strings_.end()) {
+    it->second.count += count;
+    it->second.memsize += memsize;
+    return;
+  }
+
+  if (strings_.size() >= kMaxTrackedStrings * 2) {
+    prune_strings();
+  }
+  Stats &s = strings_[value];
+  s.count = count;
+  s.memsize = memsize;
+}
+
+// Misra-Gries decrement, batched: subtract the count of the
+// kMaxTrackedStrings-th most common value from every counter and drop the
+// ones that reach zero, leaving at most kMaxTrackedStrings counters.
+void HeapSummary::prune_strings() {
+  if (strings_.size() <= kMaxTrackedStrings) {
+    return;
+  }
+
+  std::vector<size_t> counts;
+  counts.reserve(strings_.size());
+  for (auto &it : strings_) {
+    counts.push_back(it.second.count);
+  }
+  std::nth_element(counts.begin(), counts.begin() + kMaxTrackedStrings, counts.end(), std::greater<size_t>());
+  size_t threshold = counts[kMaxTrackedStrings];
+
+  for (auto it = strings_.begin(); it != strings_.end();) {
+    if (it->second.count <= threshold) {
+      it = strings_.erase(it);
+    } else {
+      it->second.count -= threshold;
+      ++it;
+    }
+  }
+  strings_pruned_ = true;
+}
+
+void HeapSummary::merge(const HeapSummary &other) {
+  total_count_ += other.total_count_;
+  total_memsize_ += other.total_memsize_;
+  for (uint32_t i = 0; i <= RUBY_T_MASK; ++i) {
+    type_stats_[i].count += other.type_stats_[i].count;
+    type_stats_[i].memsize += other.type_stats_[i].memsize;
+  }
+  for (auto &it : other.class_stats_) {
+    Stats &s = class_stats_[it.first];
+    s.count += it.second.count;
+    s.memsize += it.second.memsize;
+  }
+  for (auto &it : other.class_names_) {
+    class_names_[it.first] = it.second;
+  }
+  for (auto &it : other.strings_) {
+    add_string(it.first, it.second.count, it.second.memsize);
+  }
+  strings_pruned_ |= other.strings_pruned_;
+}
+
+void HeapSummary::print(FILE *out, size_t limit) {
+  fprintf(out, "total objects: %'zu\n", total_count_);
+  fprintf(out, "total heap memsize: %'zu bytes\n", total_memsize_);
+
+  std::vector<uint32_t> types;
+  for (uint32_t i = 0; i <= RUBY_T_MASK; ++i) {
+    if (type_stats_[i].count) {
+      types.push_back(i);
+    }
+  }
+  std::sort(types.begin(), types.end(), [&] (uint32_t a, uint32_t b) {
+    return type_stats_[a].memsize > type_stats_[b].memsize;
+  });
+  fprintf(out, "\nby type:\n%12s %16s  %s\n", "count", "memsize", "type");
+  for (auto type : types) {
+    fprintf(out, "%'12zu %'16zu  %s\n", type_stats_[type].count, type_stats_[type].memsize,
+        RubyHeapObj::get_value_type_string(type));
+  }
+
+  std::vector<std::pair<uint64_t, Stats>> classes(class_stats_.begin(), class_stats_.end());
+  size_t n = std::min(limit, classes.size());
+  std::partial_sort(classes.begin(), classes.begin() + n, classes.end(),
+      [] (const std::pair<uint64_t, Stats> &a, const std::pair<uint64_t, Stats> &b) {
+    return a.second.memsize > b.second.memsize;
+  });
+  fprintf(out, "\ntop %zu of %'zu classes by memsize:\n%12s %16s  %s\n", n, classes.size(), "count", "memsize", "class");
+  for (size_t i = 0; i < n; ++i) {
+    auto name = class_names_.find(classes[i].first);
+    if (name != class_names_.end()) {
+      fprintf(out, "%'12zu %'16zu  %s\n", classes[i].second.count, classes[i].second.memsize, name->second.c_str());
+    } else {
+      fprintf(out, "%'12zu %'16zu  0x%" PRIx64 "\n", classes[i].second.count, classes[i].second.memsize, classes[i].first);
+    }
+  }
+
+  prune_strings();
+  std::vector<std::pair<std::string, Stats>> strings(strings_.begin(), strings_.end());
+  n = std::min(limit, strings.size());
+  std::partial_sort(strings.begin(), strings.begin() + n, strings.end(),
+      [] (const std::pair<std::string, Stats> &a, const std::pair<std::string, Stats> &b) {
+    return a.second.count > b.second.count;
+  });
+  fprintf(out, "\ntop %zu string values by count%s:\n%12s %16s  %s\n", n,
+      strings_pruned_ ? " (approximate)" : "", "count", "memsize", "value");
+  for (size_t i = 0; i < n; ++i) {
+    fprintf(out, "%'12zu %'16zu  \"%.64s%s\"\n", strings[i].second.count, strings[i].second.memsize,
+        strings[i].first.c_str(), strings[i].first.size() > 64 ? "..." : "");
+  }
+}
+
+HeapSummary * HeapSummary::summarize(const char *path) {
+  std::vector<uint64_t> bounds;
+  size_t num_ranges = 1;
+  bool split = false;
+
+  InputStream *in = InputStream::open(path);
+  if (!in) {
+    return NULL;
+  }
+  uint64_t size = in->get_size();
+  if (size > 0) {
+    size_t max_ranges = std::max<uint64_t>(1, std::min<uint64_t>(parallel_concurrency(), size / kMinRangeSize));
+    if (max_ranges > 1 && InputStream::split(path, max_ranges, bounds)) {
+      split = true;
+      num_ranges = bounds.size() - 1;
+      delete in;
+      in = NULL;
+    }
+  }
+
+  Progress progress("summarizing", size, Progress::kBytes);
+  progress.start();
+
+  std::vector<HeapSummary> summaries(num_ranges);
+  std::vector<int> errors(num_ranges, 0);
+  std::vector<std::thread> threads;
+  std::atomic<uint64_t> items(0);
+
+  auto summarize_range = [&] (size_t i) {
+    InputStream *range = split ? InputStream::open(path, bounds[i], bounds[i + 1]) : in;
+    if (!range) {
+      errors[i] = errno;
+      return;
+    }
+
+    uint64_t reported = 0;
+    Parser parser(range);
+    parser.set_streaming(true);
+    parser.parse([&] (RubyHeapObj *obj) {
+      summaries[i].add(obj);
+      if ((summaries[i].total_count_ & 0xfff) == 0) {
+        uint64_t pos = range->get_source_position();
+        progress.increment(pos - reported);
+        reported = pos;
+      }
+    });
+    progress.increment(range->get_source_position() - reported);
+    items.fetch_add(parser.get_heap_object_count(), std::memory_order_relaxed);
+    errors[i] = range->get_error();
+
+    delete range;
+  };
+
+  for (size_t i = 0; i < num_ranges; ++i) {
+    threads.push_back(std::thread(summarize_range, i));
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  progress.set_items(items.load());
+  progress.complete();
+
+  for (size_t i = 1; i < num_ranges; ++i) {
+    summaries[0].merge(summaries[i]);
+  }
+  for (size_t i = 0; i < num_ranges; ++i) {
+    if (errors[i]) {
+      errno = errors[i];
+      return NULL;
+    }
+  }
+
+  return new HeapSummary(summaries[0]);
+}
+
+}
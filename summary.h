@@ -0,0 +1,57 @@
+#ifndef HARB_SUMMARY_H
+#define HARB_SUMMARY_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include <string>
+#include <unordered_map>
+
+#include "sparsehash/sparse_hash_map"
+
+#include "ruby_heap_obj.h"
+
+namespace harb {
+
+// Per-type and per-class totals and the most common string values of a
+// dump, gathered in a single streaming pass without building a Graph.
+// Memory is bounded by the number of distinct classes: string values are
+// tracked with a fixed number of Misra-Gries counters, so their counts are
+// lower bounds once more than kMaxTrackedStrings distinct values are seen.
+class HeapSummary {
+  struct Stats {
+    size_t count, memsize;
+  };
+
+  typedef google::sparse_hash_map<uint64_t, Stats> ClassStatsMap;
+  typedef google::sparse_hash_map<uint64_t, std::string> ClassNameMap;
+  typedef std::unordered_map<std::string, Stats> StringStatsMap;
+
+  size_t total_count_, total_memsize_;
+  Stats type_stats_[RUBY_T_MASK + 1];
+  ClassStatsMap class_stats_;
+  ClassNameMap class_names_;
+  StringStatsMap strings_;
+  bool strings_pruned_;
+
+  void add_string(const std::string &value, size_t count, size_t memsize);
+  void prune_strings();
+
+public:
+  static const size_t kMaxTrackedStrings = 4096;
+  static const size_t kMaxStringKeyLength = 256;
+
+  HeapSummary();
+
+  void add(RubyHeapObj *obj);
+  void merge(const HeapSummary &other);
+  void print(FILE *out, size_t limit);
+
+  // Streams the dump at path once, in parallel ranges when it is a regular
+  // uncompressed file. Returns NULL and sets errno if it can't be read.
+  static HeapSummary * summarize(const char *path);
+};
+
+}
+
+#endif // HARB_SUMMARY_H
@@ -0,0 +1,354 @@
+#include <algorithm>
+
+#include "sparsehash/sparse_hash_set"
+
+#include "cancellation.h"
+#include "graph.h"
+#include "whatif.h"
+
+namespace harb {
+
+static const uint32_t kNone = UINT32_MAX;
+
+// Per node state, kept between simulations so it's never cleared: like
+// path_search_ in main.cc, an entry is only valid when its stamp matches
+// the current simulation's epoch. scope holds 2 * epoch, plus 1 for
+// objects in the scope's dominator subtree.
+static struct {
+  uint32_t epoch;
+  std::vector<uint32_t> scope;
+  std::vector<uint32_t> local_stamp;
+  std::vector<uint32_t> local;
+} scratch_;
+
+RemovalSimulation::RemovalSimulation(Graph *graph)
+  : graph(graph), drop_from(NULL), drop_to(NULL), scope(NULL), freed_count(0), freed_memsize(0) {
+}
+
+bool RemovalSimulation::drop_edge(RubyHeapObj *from, RubyHeapObj *to) {
+  bool found = false;
+  if (from->has_refs_to()) {
+    for (uint32_t i = 0; from->get_refs_to(i) && !found; ++i) {
+      found = from->get_refs_to(i) == to;
+    }
+  }
+  if (!found) {
+    return false;
+  }
+
+  drop_from = from;
+  drop_to = to;
+  scope = get_common_dominator(from, to);
+  find_affected();
+  return true;
+}
+
+void RemovalSimulation::drop_object(RubyHeapObj *obj) {
+  drop_from = NULL;
+  drop_to = obj;
+  scope = graph->get_idom(obj);
+  find_affected();
+}
+
+// Returns NULL if either object isn't reachable from the root
+RubyHeapObj * RemovalSimulation::get_common_dominator(RubyHeapObj *a, RubyHeapObj *b) {
+  RubyHeapObj *root = graph->get_root();
+  google::sparse_hash_set<RubyHeapObj *> chain;
+  for (RubyHeapObj *cur = a; cur; cur = graph->get_idom(cur)) {
+    chain.insert(cur);
+    if (cur == root) {
+      break;
+    }
+  }
+  if (chain.find(root) == chain.end()) {
+    return NULL;
+  }
+
+  for (RubyHeapObj *cur = b; cur; cur = graph->get_idom(cur)) {
+    if (chain.find(cur) != chain.end()) {
+      return cur;
+    }
+  }
+  return NULL;
+}
+
+// Whether the scope dominates obj. Each object's answer is remembered, so
+// the dominator chains are only walked once per simulation.
+bool RemovalSimulation::in_scope(RubyHeapObj *obj) {
+  uint32_t in = scratch_.epoch * 2 + 1, out = scratch_.epoch * 2;
+  uint32_t result = out;
+  chain.clear();
+  for (RubyHeapObj *cur = obj; cur; cur = graph->get_idom(cur)) {
+    uint32_t known = scratch_.scope[cur->get_index()];
+    if (cur == scope) {
+      result = in;
+      break;
+    } else if (known == in || known == out) {
+      result = known;
+      break;
+    }
+    chain.push_back(cur->get_index());
+  }
+  for (auto idx : chain) {
+    scratch_.scope[idx] = result;
+  }
+  return result == in;
+}
+
+uint32_t RemovalSimulation::get_local(RubyHeapObj *obj) {
+  uint32_t idx = obj->get_index();
+  return scratch_.local_stamp[idx] == scratch_.epoch ? scratch_.local[idx] : kNone;
+}
+
+uint32_t RemovalSimulation::add_local(RubyHeapObj *obj, bool affected) {
+  uint32_t idx = obj->get_index();
+  uint32_t id = nodes.size();
+  scratch_.local_stamp[idx] = scratch_.epoch;
+  scratch_.local[idx] = id;
+  nodes.push_back(obj);
+  is_affected.push_back(affected);
+  if (affected) {
+    this->affected.push_back(id);
+  }
+  return id;
+}
+
+// Adds obj and its dominators, up to the first one already added
+void RemovalSimulation::add_chain(RubyHeapObj *obj) {
+  for (RubyHeapObj *cur = obj; cur && get_local(cur) == kNone; cur = graph->get_idom(cur)) {
+    add_local(cur, false);
+  }
+}
+
+void RemovalSimulation::find_affected() {
+  nodes.clear();
+  is_affected.clear();
+  affected.clear();
+  if (!scope) {
+    // Nothing that is reachable would change
+    return;
+  }
+
+  size_t num_nodes = graph->get_num_nodes();
+  if (scratch_.local.size() != num_nodes || ++scratch_.epoch >= INT32_MAX) {
+    scratch_.scope.assign(num_nodes, 0);
+    scratch_.local_stamp.assign(num_nodes, 0);
+    scratch_.local.resize(num_nodes);
+    scratch_.epoch = 1;
+  }
+  add_local(scope, false);
+
+  // Everything in the scope that the target reaches. If that includes the
+  // scope itself, it's the scope's whole dominator subtree.
+  std::vector<uint32_t> stack;
+  if (drop_to != scope) {
+    add_local(drop_to, true);
+  }
+  stack.push_back(drop_to->get_index());
+  bool scope_expanded = drop_to == scope;
+  auto visit = [&] (RubyHeapObj *child) {
+    if (child == scope && !scope_expanded) {
+      scope_expanded = true;
+      stack.push_back(child->get_index());
+    } else if (get_local(child) == kNone && in_scope(child)) {
+      add_local(child, true);
+      stack.push_back(child->get_index());
+    }
+  };
+  while (!stack.empty()) {
+    if (Cancellation::requested()) {
+      return;
+    }
+    RubyHeapObj *obj = graph->get_node(stack.back());
+    stack.pop_back();
+    if (obj == graph->get_root()) {
+      for (auto child : *obj->get_root_children()) {
+        visit(child);
+      }
+    } else if (obj->has_refs_to()) {
+      for (uint32_t i = 0; obj->get_refs_to(i); ++i) {
+        visit(obj->get_refs_to(i));
+      }
+    }
+  }
+
+  // Every path into the affected objects comes from an object whose
+  // dominators don't change, so its dominator chain up to the scope stands
+  // in for the rest of the heap. The old idoms are added too, so retained
+  // sizes can be adjusted.
+  for (size_t i = 0; i < affected.size(); ++i) {
+    RubyHeapObj *obj = nodes[affected[i]];
+    add_chain(graph->get_idom(obj));
+    for (auto ref : *obj->get_refs_from()) {
+      if (!is_dropped(ref, obj) && get_local(ref) == kNone && in_scope(ref)) {
+        add_chain(ref);
+      }
+    }
+  }
+}
+
+// The recomputed graph's edges: old dominator tree edges into the
+// unaffected objects, and the remaining references into the affected ones
+template<typename Func> void RemovalSimulation::each_edge(Func func) {
+  for (uint32_t w = 1; w < nodes.size(); ++w) {
+    RubyHeapObj *obj = nodes[w];
+    if (!is_affected[w]) {
+      func(get_local(graph->get_idom(obj)), w);
+      continue;
+    }
+    for (auto ref : *obj->get_refs_from()) {
+      uint32_t u = get_local(ref);
+      if (u != kNone && !is_dropped(ref, obj)) {
+        func(u, w);
+      }
+    }
+  }
+}
+
+void RemovalSimulation::simulate() {
+  freed_count = freed_memsize = 0;
+  changes.clear();
+  if (nodes.empty()) {
+    return;
+  }
+  uint32_t n = nodes.size();
+
+  // The edges both ways as flat arrays (CSR), indexed by local id
+  std::vector<uint32_t> child_start(n + 1, 0), pred_start(n + 1, 0);
+  each_edge([&] (uint32_t u, uint32_t w) {
+    child_start[u + 1]++;
+    pred_start[w + 1]++;
+  });
+  for (uint32_t u = 0; u < n; ++u) {
+    child_start[u + 1] += child_start[u];
+    pred_start[u + 1] += pred_start[u];
+  }
+  std::vector<uint32_t> children(child_start[n]), preds(pred_start[n]);
+  std::vector<uint32_t> next_child(child_start.begin(), child_start.end() - 1);
+  std::vector<uint32_t> next_pred(pred_start.begin(), pred_start.end() - 1);
+  each_edge([&] (uint32_t u, uint32_t w) {
+    children[next_child[u]++] = w;
+    preds[next_pred[w]++] = u;
+  });
+
+  // Iterative DFS from the scope for a postorder of what it still reaches.
+  // Each stack entry is a node and the position of its next child.
+  const uint32_t kUnreached = UINT32_MAX;
+  std::vector<uint32_t> order(n, kUnreached);
+  std::vector<uint32_t> postorder;
+  std::vector<std::pair<uint32_t, uint32_t>> stack;
+  postorder.reserve(n);
+  order[0] = 0;
+  stack.push_back(std::make_pair(0, child_start[0]));
+  while (!stack.empty()) {
+    if (Cancellation::requested()) {
+      return;
+    }
+    uint32_t u = stack.back().first;
+    uint32_t pos = stack.back().second;
+    if (pos == child_start[u + 1]) {
+      order[u] = postorder.size();
+      postorder.push_back(u);
+      stack.pop_back();
+      continue;
+    }
+    stack.back().second++;
+    uint32_t w = children[pos];
+    if (order[w] == kUnreached) {
+      order[w] = 0;
+      stack.push_back(std::make_pair(w, child_start[w]));
+    }
+  }
+
+  // order[] now holds postorder numbers; the scope has the highest
+  std::vector<uint32_t> idom(n, kUnreached);
+  idom[0] = 0;
+  auto intersect = [&] (uint32_t a, uint32_t b) {
+    while (a != b) {
+      while (order[a] < order[b]) {
+        a = idom[a];
+      }
+      while (order[b] < order[a]) {
+        b = idom[b];
+      }
+    }
+    return a;
+  };
+
+  bool changed = true;
+  while (changed) {
+    if (Cancellation::requested()) {
+      return;
+    }
+    changed = false;
+    for (size_t i = postorder.size() - 1; i-- > 0;) {
+      uint32_t u = postorder[i];
+      uint32_t new_idom = kUnreached;
+      for (uint32_t j = pred_start[u]; j < pred_start[u + 1]; ++j) {
+        uint32_t p = preds[j];
+        if (idom[p] == kUnreached) {
+          continue;
+        }
+        new_idom = new_idom == kUnreached ? p : intersect(p, new_idom);
+      }
+      if (idom[u] != new_idom) {
+        idom[u] = new_idom;
+        changed = true;
+      }
+    }
+  }
+
+  // Affected memory under each object, bottom-up over the new tree. The
+  // affected objects only ever dominate other affected objects, so for
+  // them this is their whole retained size.
+  std::vector<size_t> after(n, 0), before(n, 0);
+  for (auto u : postorder) {
+    after[u] += is_affected[u] ? nodes[u]->get_memsize() : 0;
+    if (u != 0) {
+      after[idom[u]] += after[u];
+    }
+  }
+
+  // And under each unaffected object in the old tree
+  for (auto u : affected) {
+    uint32_t old_idom = get_local(graph->get_idom(nodes[u]));
+    if (!is_affected[old_idom]) {
+      before[old_idom] += graph->get_retained_size(nodes[u]);
+    }
+  }
+  for (auto u : postorder) {
+    if (u != 0 && !is_affected[u]) {
+      before[get_local(graph->get_idom(nodes[u]))] += before[u];
+    }
+  }
+
+  for (uint32_t u = 0; u < n; ++u) {
+    size_t retained = graph->get_retained_size(nodes[u]);
+    if (is_affected[u] && idom[u] == kUnreached) {
+      freed_count++;
+      freed_memsize += nodes[u]->get_memsize();
+      continue;
+    }
+    size_t now = is_affected[u] ? after[u] : retained - before[u] + after[u];
+    if (now != retained) {
+      Change c = { nodes[u], retained, now };
+      changes.push_back(c);
+    }
+  }
+
+  // Every dominator above the scope retains exactly the freed memory less
+  if (freed_memsize > 0) {
+    for (RubyHeapObj *cur = graph->get_idom(scope); cur; cur = graph->get_idom(cur)) {
+      size_t before = graph->get_retained_size(cur);
+      Change c = { cur, before, before - freed_memsize };
+      changes.push_back(c);
+    }
+  }
+
+  std::sort(changes.begin(), changes.end(), [] (const Change &a, const Change &b) {
+    int64_t da = a.before - a.after, db = b.before - b.after;
+    return da > db || (da == db && a.obj->get_index() < b.obj->get_index());
+  });
+}
+
+}
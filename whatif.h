@@ -0,0 +1,91 @@
+#ifndef HARB_WHATIF_H
+#define HARB_WHATIF_H
+
+#include <unistd.h>
+
+#include <vector>
+
+#include "ruby_heap_obj.h"
+
+namespace harb {
+
+class Graph;
+
+// Simulates removing a reference or an object and works out what would be
+// freed and how retained sizes would change, without rebuilding the
+// dominator tree. Removing edges only affects objects dominated by the
+// nearest common dominator d of the removed edges' ends, and of those only
+// the ones reachable from the removed edges' target: a path that doesn't
+// pass through the target can't use a removed edge. Every path into that
+// affected region comes from an object whose dominators are unchanged, so
+// dominators are recomputed (Cooper, Harvey and Kennedy's iterative
+// algorithm) over a small graph: the affected objects, with the objects
+// that reference them standing in for the rest of the heap through their
+// old dominator chains up to d. Affected objects d no longer reaches are
+// freed.
+class RemovalSimulation {
+  public:
+    struct Change {
+      RubyHeapObj *obj;
+      size_t before, after;
+    };
+
+    RemovalSimulation(Graph *graph);
+
+    // Removes every reference from `from` to `to` and finds the objects
+    // whose dominators may change. Returns false if there are no such
+    // references.
+    bool drop_edge(RubyHeapObj *from, RubyHeapObj *to);
+
+    // Removes every reference to obj and finds the objects whose dominators
+    // may change
+    void drop_object(RubyHeapObj *obj);
+
+    // The number of objects whose dominators have to be recomputed. When
+    // that's most of the heap, simulate() costs about as much as building
+    // the dominator tree again.
+    size_t get_num_affected() { return affected.size(); }
+
+    // Recomputes the affected objects' dominators and retained sizes
+    void simulate();
+
+    size_t get_freed_count() { return freed_count; }
+    size_t get_freed_memsize() { return freed_memsize; }
+
+    // Objects whose retained size would change, largest decrease first.
+    // Objects that would be freed are not included.
+    const std::vector<Change> & get_changes() { return changes; }
+
+  private:
+    Graph *graph;
+    RubyHeapObj *drop_from;
+    RubyHeapObj *drop_to;
+    RubyHeapObj *scope;
+    size_t freed_count;
+    size_t freed_memsize;
+    std::vector<Change> changes;
+
+    // The recomputed graph, by local id: the scope d is 0, then the
+    // affected objects and the objects on the dominator chains that lead
+    // into them
+    std::vector<RubyHeapObj *> nodes;
+    std::vector<bool> is_affected;
+    std::vector<uint32_t> affected;
+    std::vector<uint32_t> chain; // scratch for in_scope()
+
+    bool is_dropped(RubyHeapObj *from, RubyHeapObj *to) {
+      return to == drop_to && (drop_from == NULL || from == drop_from);
+    }
+
+    RubyHeapObj * get_common_dominator(RubyHeapObj *a, RubyHeapObj *b);
+    void find_affected();
+    bool in_scope(RubyHeapObj *obj);
+    uint32_t get_local(RubyHeapObj *obj);
+    uint32_t add_local(RubyHeapObj *obj, bool affected);
+    void add_chain(RubyHeapObj *obj);
+    template<typename Func> void each_edge(Func func);
+};
+
+}
+
+#endif // HARB_WHATIF_H